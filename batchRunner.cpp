@@ -0,0 +1,177 @@
+//
+//  batchRunner.cpp
+//  pds_dmm
+//
+//  Copyright (c) 2012 University of Michigan. All rights reserved.
+//
+
+#include "batchRunner.h"
+
+/**************************************************************************************************/
+
+static mutex consoleLock;
+
+static void runJob(batchSettings&, batchJob*);
+
+/**************************************************************************************************/
+
+//each manifest line is "shared [design [minK maxK]]"; a design of "none" asks for a sweep over K and
+//missing K limits come from -minpartitions/-maxpartitions. blank lines and lines starting with # are skipped
+
+static vector<batchJob*> readManifest(string manifestFileName, batchSettings& settings){
+
+    ifstream manifestFile(manifestFileName.c_str());
+    if(!manifestFile){
+        cerr << "Error: could not open " << manifestFileName << endl;
+        exit(1);
+    }
+
+    vector<batchJob*> jobs;
+
+    while(manifestFile){
+        string line = getline(manifestFile);
+        stringstream lineStream(line);
+
+        string sharedFileName;
+        if(!(lineStream >> sharedFileName) || sharedFileName[0] == '#'){  continue;   }
+
+        batchJob* job = new batchJob();
+        job->sharedFileName = sharedFileName;
+        job->minPartitions = settings.minPartitions;
+        job->maxPartitions = settings.maxPartitions;
+
+        string designFileName;
+        if(lineStream >> designFileName && designFileName != "none"){  job->designFileName = designFileName;  }
+        lineStream >> job->minPartitions >> job->maxPartitions;
+
+        if(job->maxPartitions < 1){
+            cerr << "Error: no K to fit for " << sharedFileName << " in " << manifestFileName << endl;
+            exit(1);
+        }
+
+        jobs.push_back(job);
+    }
+
+    return jobs;
+}
+
+/**************************************************************************************************/
+
+//each job is one pool task that reads its data and runs its sweep (or design fit) to the end, so the
+//-optimize early stop and the summary reference work as in a single run. jobs are queued by the size of
+//their count file times their largest K so the longest ones start first
+
+void runBatch(string manifestFileName, batchSettings& settings){
+
+    vector<batchJob*> jobs = readManifest(manifestFileName, settings);
+
+    cout.setf(ios::fixed, ios::floatfield);
+    cout.setf(ios::showpoint);
+    cout << "File\tK\tNLE\t\tlogDet\tBIC\t\tAIC\t\tLaplace" << endl;
+
+    threadPool pool(settings.processors);
+
+    for(int i=0;i<jobs.size();i++){
+        batchJob* job = jobs[i];
+
+        ifstream sharedFile(job->sharedFileName.c_str(), ios::binary | ios::ate);
+        double fileSize = sharedFile ? (double)sharedFile.tellg() : 0.0000;
+
+        pool.submit([&settings, job](){  runJob(settings, job);    }, fileSize * job->maxPartitions);
+    }
+    pool.wait();
+
+    for(int i=0;i<jobs.size();i++){ delete jobs[i];  }
+}
+
+/**************************************************************************************************/
+
+//runs on a pool thread, so input that cannot be read only ends this job
+
+static void runJob(batchSettings& settings, batchJob* job){
+
+    vector<vector<int> > sharedMatrix;
+    vector<string> otuNames, sampleNames;
+    vector<vector<double> > partitions;
+    CountSource* source = NULL;
+
+    try{
+        source = readCountFile(job->sharedFileName, "", 0, sharedMatrix, otuNames, sampleNames);
+        if(job->designFileName != ""){  readDesignFile(job->designFileName, sampleNames, partitions);  }
+    }
+    catch(inputError& e){
+        lock_guard<mutex> lock(consoleLock);
+        cerr << "Error: " << e.what() << "; skipping " << job->sharedFileName << endl;
+        delete source;
+        return;
+    }
+
+    CountDataset data = (source != NULL) ? CountDataset(*source, sampleNames, otuNames) : CountDataset(sharedMatrix, sampleNames, otuNames);
+
+    stringstream fitData;
+    fitData.setf(ios::fixed, ios::floatfield);
+    fitData.setf(ios::showpoint);
+    fitData << "K\tNLE\tlogDet\tBIC\tAIC\tLaplace" << endl;
+
+    string fileRoot;
+    dmmResults best;
+
+    if(job->designFileName != ""){
+        fileRoot = job->designFileName.substr(0,job->designFileName.find_last_of(".")+1);
+        best = fitDesign(data, partitions, settings.options);
+
+        fitData << best.numPartitions << '\t';
+        fitData << setprecision (2) << best.nll << '\t' << best.logDeterminant << '\t';
+        fitData << best.bic << '\t' << best.aic << '\t' << best.laplace << endl;
+    }
+    else{
+        fileRoot = job->sharedFileName.substr(0,job->sharedFileName.find_last_of(".")+1);
+
+        sweepOptions sweepSettings;
+        sweepSettings.minPartitions = job->minPartitions;
+        sweepSettings.maxPartitions = job->maxPartitions;
+        sweepSettings.optimizeGap = settings.optimizeGap;
+        sweepSettings.adaptive = settings.adaptive;
+        sweepSettings.confirmWindow = settings.confirmWindow;
+
+        if(settings.cacheDirectory != "" && source != NULL) {   sweepSettings.cache = new fitCache(settings.cacheDirectory, *source);    }
+        else if(settings.cacheDirectory != "")              {   sweepSettings.cache = new fitCache(settings.cacheDirectory, sharedMatrix);   }
+
+        //an adaptive search fits K out of order, so rows are listed by K once the sweep is done
+        map<int, string> fitRows;
+        dmmResults reference;
+
+        sweep(data, sweepSettings, settings.options, [&](dmmResults& results, bool isBest){
+            stringstream row;
+            row.setf(ios::fixed, ios::floatfield);
+            row.setf(ios::showpoint);
+            row << results.numPartitions << '\t';
+            row << setprecision (2) << results.nll << '\t' << results.logDeterminant << '\t';
+            row << results.bic << '\t' << results.aic << '\t' << results.laplace;
+            fitRows[results.numPartitions] = row.str();
+
+            writeResults(fileRoot+toString(results.numPartitions), results, sampleNames, otuNames, settings.output);
+        }, reference, best);
+
+        delete sweepSettings.cache;
+
+        for(map<int, string>::iterator it=fitRows.begin();it!=fitRows.end();it++){  fitData << it->second << endl;   }
+        generateSummaryFile(reference, best, otuNames, sampleNames, fileRoot);
+    }
+
+    string fitFileName = (job->designFileName != "") ? fileRoot+"fit" : fileRoot+"mix.fit";
+    ofstream fitFile(fitFileName.c_str());
+    fitFile << fitData.str();
+    fitFile.close();
+
+    {
+        lock_guard<mutex> lock(consoleLock);
+        cout << job->sharedFileName << '\t' << best.numPartitions << '\t';
+        cout << setprecision (2) << best.nll << '\t' << best.logDeterminant << '\t';
+        cout << best.bic << '\t' << best.aic << '\t' << best.laplace << endl;
+    }
+
+    delete source;
+}
+
+/**************************************************************************************************/
@@ -0,0 +1,53 @@
+//
+//  batchRunner.h
+//  pds_dmm
+//
+//  Copyright (c) 2012 University of Michigan. All rights reserved.
+//
+
+#ifndef pds_dmm_batchRunner_h
+#define pds_dmm_batchRunner_h
+
+/**************************************************************************************************/
+
+#include "libpdsdmm.h"
+#include "threadPool.h"
+
+/**************************************************************************************************/
+
+//one line of a batch manifest: a shared (or BIOM/MatrixMarket) file, an optional design file and the
+//range of K to fit. a sweep job runs the same sweep (and writes the same files) a single run on that data
+//would; a job whose files cannot be read is reported and skipped
+
+struct batchJob {
+
+    string sharedFileName;
+    string designFileName;
+    int minPartitions;
+    int maxPartitions;
+
+};
+
+/**************************************************************************************************/
+
+struct batchSettings {
+
+    dmmOptions options;
+    outputSettings output;
+    string cacheDirectory;
+    int minPartitions;
+    int maxPartitions;
+    int optimizeGap;
+    bool adaptive;
+    int confirmWindow;
+    int processors;
+
+};
+
+/**************************************************************************************************/
+
+void runBatch(string, batchSettings&);
+
+/**************************************************************************************************/
+
+#endif
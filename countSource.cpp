@@ -0,0 +1,808 @@
+//
+//  countSource.cpp
+//  pds_dmm
+//
+//  Copyright (c) 2012 University of Michigan. All rights reserved.
+//
+
+#include "countSource.h"
+
+#include <random>
+#include <unistd.h>
+
+/**************************************************************************************************/
+
+//the otu names from the first line of a shared file
+
+static void readSharedHeader(istream& sharedFile, vector<string>& otuNames){
+
+    string header = getline(sharedFile);
+    string colHead;
+
+    stringstream line(header);
+    line >> colHead;
+    line >> colHead;
+    line >> colHead;
+
+    while(line){
+        line >> header;
+        otuNames.push_back(header);
+        gobble(line);
+    }
+}
+
+/**************************************************************************************************/
+
+//each row of the chunk file is the number of nonzero counts followed by that many (otu, count) pairs;
+//only one row of the shared file is held in memory while converting, so "-" can stream it from stdin. the
+//chunk file gets a unique name in chunkDirectory, so concurrent runs never share one
+
+ChunkedCountFile::ChunkedCountFile(string sharedFileName, string chunkDirectory, double memoryBudget, vector<string>& otuNames, vector<string>& sampleNames) : numSamples(0), numOTUs(0), nextSample(0) {
+
+    string chunkTemplate = chunkDirectory + "/pds_dmm.chunks.XXXXXX";
+    vector<char> chunkName(chunkTemplate.begin(), chunkTemplate.end());
+    chunkName.push_back('\0');
+
+    int chunkDescriptor = mkstemp(&chunkName[0]);
+    if(chunkDescriptor == -1){  throw inputError("could not create a chunk file in " + chunkDirectory);   }
+    close(chunkDescriptor);
+    chunkFileName = &chunkName[0];
+
+    ifstream inFile;
+    if(sharedFileName != "-"){
+        inFile.open(sharedFileName.c_str());
+        if(!inFile){
+            remove(chunkFileName.c_str());
+            throw inputError("could not open " + sharedFileName);
+        }
+    }
+    istream& sharedFile = (sharedFileName == "-") ? cin : inFile;
+
+    readSharedHeader(sharedFile, otuNames);
+
+    ofstream outFile(chunkFileName.c_str(), ios::binary);
+
+    string label;
+    string sample;
+    int numRowOTUs;
+    vector<int> counts, row;
+
+    while(sharedFile){
+
+        sharedFile >> label >> sample >> numRowOTUs;
+
+        counts.resize(numRowOTUs);
+        row.assign(1, 0);
+        for(int i=0;i<numRowOTUs;i++){
+            sharedFile >> counts[i];
+            if(counts[i] != 0){
+                row.push_back(i);
+                row.push_back(counts[i]);
+                row[0]++;
+            }
+        }
+        outFile.write((const char*)&row[0], row.size() * sizeof(int));
+
+        sampleNames.push_back(sample);
+        numOTUs = numRowOTUs;
+        numSamples++;
+
+        gobble(sharedFile);
+    }
+    outFile.close();
+
+    //an entry costs an otu and a count; keep at least one row per block
+    maxBlockEntries = (size_t)max(1.0, memoryBudget / (2.0 * sizeof(int)));
+
+    chunkFile.open(chunkFileName.c_str(), ios::binary);
+}
+
+/**************************************************************************************************/
+
+ChunkedCountFile::~ChunkedCountFile(){
+    chunkFile.close();
+    remove(chunkFileName.c_str());
+}
+
+/**************************************************************************************************/
+
+void ChunkedCountFile::rewind(){
+    chunkFile.clear();
+    chunkFile.seekg(0, ios::beg);
+    nextSample = 0;
+}
+
+/**************************************************************************************************/
+
+const countBlock* ChunkedCountFile::nextBlock(){
+
+    if(nextSample >= numSamples){   return NULL;    }
+
+    block.firstSample = nextSample;
+    block.numSamples = 0;
+    block.rowStart.assign(1, 0);
+    block.otus.clear();
+    block.counts.clear();
+    block.totals.clear();
+
+    vector<int> pairs;
+
+    while(nextSample < numSamples && (block.numSamples == 0 || block.otus.size() < maxBlockEntries)){
+        int numNonZero;
+        chunkFile.read((char*)&numNonZero, sizeof(int));
+
+        pairs.resize(2 * numNonZero);
+        if(numNonZero > 0){ chunkFile.read((char*)&pairs[0], pairs.size() * sizeof(int));   }
+
+        int total = 0;
+        for(int i=0;i<numNonZero;i++){
+            block.otus.push_back(pairs[2*i]);
+            block.counts.push_back(pairs[2*i+1]);
+            total += pairs[2*i+1];
+        }
+        block.rowStart.push_back((int)block.otus.size());
+        block.totals.push_back(total);
+
+        block.numSamples++;
+        nextSample++;
+    }
+
+    return &block;
+}
+
+/**************************************************************************************************/
+
+SharedFileReader::SharedFileReader(string sharedFileName, int b) : sharedFile(&cin), blockSize(max(b, 1)), nextSample(0) {
+
+    if(sharedFileName != "-"){
+        inFile.open(sharedFileName.c_str());
+        if(!inFile){
+            throw inputError("could not open " + sharedFileName);
+        }
+        sharedFile = &inFile;
+    }
+
+    readSharedHeader(*sharedFile, otuNames);
+}
+
+/**************************************************************************************************/
+
+//reads up to blockSize rows into sparse form and puts their names in sampleNames; NULL at the end
+
+const countBlock* SharedFileReader::nextBlock(vector<string>& sampleNames){
+
+    block.firstSample = nextSample;
+    block.numSamples = 0;
+    block.rowStart.assign(1, 0);
+    block.otus.clear();
+    block.counts.clear();
+    block.totals.clear();
+    sampleNames.clear();
+
+    string label;
+    string sample;
+    int numRowOTUs;
+    int count;
+
+    while(block.numSamples < blockSize && *sharedFile >> label >> sample >> numRowOTUs){
+        int total = 0;
+        for(int i=0;i<numRowOTUs;i++){
+            *sharedFile >> count;
+            if(count != 0){
+                block.otus.push_back(i);
+                block.counts.push_back(count);
+                total += count;
+            }
+        }
+        block.rowStart.push_back((int)block.otus.size());
+        block.totals.push_back(total);
+        sampleNames.push_back(sample);
+
+        block.numSamples++;
+        gobble(*sharedFile);
+    }
+    nextSample += block.numSamples;
+
+    if(block.numSamples == 0){  return NULL;    }
+    return &block;
+}
+
+/**************************************************************************************************/
+
+//entries are placed with two counting sorts (by otu, then stably by sample) so every row comes out ordered
+//by otu and repeated (sample, otu) entries can be merged
+
+SparseCountMatrix::SparseCountMatrix(int s, int o, vector<int>& samples, vector<int>& otus, vector<int>& counts) : numSamples(s), numOTUs(o), finished(false) {
+
+    size_t numEntries = counts.size();
+
+    vector<size_t> otuStart(numOTUs + 1, 0);
+    for(size_t i=0;i<numEntries;i++){   otuStart[otus[i]+1]++;  }
+    for(int i=0;i<numOTUs;i++){         otuStart[i+1] += otuStart[i];   }
+
+    vector<size_t> byOTU(numEntries);
+    for(size_t i=0;i<numEntries;i++){   byOTU[otuStart[otus[i]]++] = i; }
+
+    vector<size_t> sampleStart(numSamples + 1, 0);
+    for(size_t i=0;i<numEntries;i++){   sampleStart[samples[i]+1]++;    }
+    for(int i=0;i<numSamples;i++){      sampleStart[i+1] += sampleStart[i]; }
+
+    vector<size_t> order(numEntries);
+    for(size_t i=0;i<numEntries;i++){   order[sampleStart[samples[byOTU[i]]]++] = byOTU[i]; }
+
+    block.firstSample = 0;
+    block.numSamples = numSamples;
+    block.rowStart.assign(1, 0);
+    block.totals.assign(numSamples, 0);
+    block.otus.reserve(numEntries);
+    block.counts.reserve(numEntries);
+
+    size_t next = 0;
+    for(int i=0;i<numSamples;i++){
+        int rowBegin = (int)block.otus.size();
+
+        for(;next<numEntries && samples[order[next]] == i;next++){
+            size_t entry = order[next];
+            if(counts[entry] == 0){ continue;   }
+
+            if((int)block.otus.size() > rowBegin && block.otus.back() == otus[entry]){
+                block.counts.back() += counts[entry];
+            }
+            else{
+                block.otus.push_back(otus[entry]);
+                block.counts.push_back(counts[entry]);
+            }
+            block.totals[i] += counts[entry];
+        }
+        block.rowStart.push_back((int)block.otus.size());
+    }
+}
+
+/**************************************************************************************************/
+
+SparseCountMatrix::SparseCountMatrix(const vector<vector<int> >& countMatrix) : finished(false) {
+
+    numSamples = (int)countMatrix.size();
+    numOTUs = numSamples > 0 ? (int)countMatrix[0].size() : 0;
+
+    block.firstSample = 0;
+    block.numSamples = numSamples;
+    block.rowStart.assign(1, 0);
+    block.totals.assign(numSamples, 0);
+
+    for(int i=0;i<numSamples;i++){
+        for(int j=0;j<numOTUs;j++){
+            if(countMatrix[i][j] == 0){ continue;   }
+            block.otus.push_back(j);
+            block.counts.push_back(countMatrix[i][j]);
+            block.totals[i] += countMatrix[i][j];
+        }
+        block.rowStart.push_back((int)block.otus.size());
+    }
+}
+
+/**************************************************************************************************/
+
+const countBlock* SparseCountMatrix::nextBlock(){
+
+    if(finished){   return NULL;    }
+    finished = true;
+    return &block;
+}
+
+/**************************************************************************************************/
+
+const countBlock* CountBlockView::nextBlock(){
+
+    if(finished){   return NULL;    }
+    finished = true;
+    return &block;
+}
+
+/**************************************************************************************************/
+
+static string readWholeFile(string fileName){
+
+    ifstream inFile(fileName.c_str(), ios::binary);
+    if(!inFile){
+        throw inputError("could not open " + fileName);
+    }
+
+    stringstream contents;
+    contents << inFile.rdbuf();
+    return contents.str();
+}
+
+/**************************************************************************************************/
+
+//just enough json to pull the ids, the matrix type and the data out of a BIOM 1.0 table; everything else
+//is skipped without being stored
+
+static void jsonError(string message){
+    throw inputError("could not parse BIOM file (" + message + ")");
+}
+
+static void skipSpace(const char*& p, const char* end){
+    while(p < end && isspace(*p)){  p++;    }
+}
+
+static void expect(const char*& p, const char* end, char c){
+    skipSpace(p, end);
+    if(p >= end || *p != c){    jsonError(string("expected ") + c);    }
+    p++;
+}
+
+static bool nextElement(const char*& p, const char* end, char close){
+    skipSpace(p, end);
+    if(p < end && *p == ','){   p++;    return true;    }
+    if(p < end && *p == close){ p++;    return false;   }
+    jsonError(string("expected , or ") + close);
+    return false;
+}
+
+//the four hex digits after \u; p is left on the last of them
+static unsigned int parseHex4(const char*& p, const char* end){
+    if(end - p < 5){    jsonError("short \\u escape");   }
+    unsigned int code = 0;
+    for(int i=0;i<4;i++){
+        char c = *++p;
+        code <<= 4;
+        if(c >= '0' && c <= '9')        {   code += c - '0';        }
+        else if(c >= 'a' && c <= 'f')   {   code += c - 'a' + 10;   }
+        else if(c >= 'A' && c <= 'F')   {   code += c - 'A' + 10;   }
+        else                            {   jsonError("bad \\u escape");    }
+    }
+    return code;
+}
+
+//the code point of a \u escape with p on the 'u', joining a surrogate pair when one follows
+static unsigned int parseCodePoint(const char*& p, const char* end){
+    unsigned int code = parseHex4(p, end);
+    if(code >= 0xD800 && code < 0xDC00 && end - p > 2 && p[1] == '\\' && p[2] == 'u'){
+        const char* low = p + 2;
+        unsigned int second = parseHex4(low, end);
+        if(second >= 0xDC00 && second < 0xE000){
+            code = 0x10000 + ((code - 0xD800) << 10) + (second - 0xDC00);
+            p = low;
+        }
+    }
+    return code;
+}
+
+static void appendUTF8(string& value, unsigned int code){
+    if(code < 0x80){
+        value += (char)code;
+    }
+    else if(code < 0x800){
+        value += (char)(0xC0 | (code >> 6));
+        value += (char)(0x80 | (code & 0x3F));
+    }
+    else if(code < 0x10000){
+        value += (char)(0xE0 | (code >> 12));
+        value += (char)(0x80 | ((code >> 6) & 0x3F));
+        value += (char)(0x80 | (code & 0x3F));
+    }
+    else{
+        value += (char)(0xF0 | (code >> 18));
+        value += (char)(0x80 | ((code >> 12) & 0x3F));
+        value += (char)(0x80 | ((code >> 6) & 0x3F));
+        value += (char)(0x80 | (code & 0x3F));
+    }
+}
+
+static string parseString(const char*& p, const char* end){
+
+    expect(p, end, '"');
+
+    string value;
+    while(p < end && *p != '"'){
+        if(*p == '\\' && p + 1 < end){
+            p++;
+            switch(*p){
+                case 'n':   value += '\n';  break;
+                case 't':   value += '\t';  break;
+                case 'r':   value += '\r';  break;
+                case 'b':   value += '\b';  break;
+                case 'f':   value += '\f';  break;
+                case 'u':   appendUTF8(value, parseCodePoint(p, end));  break;
+                default:    value += *p;    break;
+            }
+            p++;
+        }
+        else{
+            value += *p++;
+        }
+    }
+    if(p >= end){   jsonError("unterminated string");   }
+    p++;
+
+    return value;
+}
+
+static double parseNumber(const char*& p, const char* end){
+
+    skipSpace(p, end);
+    char* numberEnd;
+    double value = strtod(p, &numberEnd);
+    if(numberEnd == p){ jsonError("expected a number");    }
+    p = numberEnd;
+    return value;
+}
+
+static void skipValue(const char*& p, const char* end){
+
+    skipSpace(p, end);
+    if(p >= end){   jsonError("unexpected end of file");    }
+
+    if(*p == '"'){
+        parseString(p, end);
+    }
+    else if(*p == '{' || *p == '['){
+        //strings are walked through so brackets inside them do not count
+        int depth = 0;
+        while(p < end){
+            if(*p == '"')                   {   parseString(p, end);    continue;   }
+            if(*p == '{' || *p == '[')      {   depth++;    }
+            else if(*p == '}' || *p == ']') {   depth--;    }
+            p++;
+            if(depth == 0){ return; }
+        }
+        jsonError("unbalanced brackets");
+    }
+    else{
+        while(p < end && *p != ',' && *p != '}' && *p != ']' && !isspace(*p)){  p++;    }
+    }
+}
+
+//"rows" and "columns" are arrays of objects; only their "id" members are kept
+static void parseIds(const char*& p, const char* end, vector<string>& ids){
+
+    expect(p, end, '[');
+    skipSpace(p, end);
+    if(p < end && *p == ']'){   p++;    return; }
+
+    do{
+        expect(p, end, '{');
+        skipSpace(p, end);
+        if(p < end && *p == '}'){   p++;    continue;   }
+
+        do{
+            string key = parseString(p, end);
+            expect(p, end, ':');
+            if(key == "id") {   ids.push_back(parseString(p, end)); }
+            else            {   skipValue(p, end);                  }
+        }while(nextElement(p, end, '}'));
+
+    }while(nextElement(p, end, ']'));
+}
+
+/**************************************************************************************************/
+
+SparseCountMatrix* readBiomFile(string fileName, vector<string>& otuNames, vector<string>& sampleNames){
+
+    string contents = readWholeFile(fileName);
+    const char* p = contents.c_str();
+    const char* end = p + contents.size();
+
+    string matrixType = "sparse";
+    const char* data = NULL;
+
+    expect(p, end, '{');
+    do{
+        string key = parseString(p, end);
+        expect(p, end, ':');
+
+        if(key == "rows")               {   parseIds(p, end, otuNames);         }
+        else if(key == "columns")       {   parseIds(p, end, sampleNames);      }
+        else if(key == "matrix_type")   {   matrixType = parseString(p, end);   }
+        else if(key == "data")          {   skipSpace(p, end);  data = p;   skipValue(p, end);  }
+        else                            {   skipValue(p, end);                  }
+
+    }while(nextElement(p, end, '}'));
+
+    if(data == NULL){   jsonError("no data");   }
+
+    int numOTUs = (int)otuNames.size();
+    int numSamples = (int)sampleNames.size();
+
+    vector<int> samples, otus, counts;
+
+    p = data;
+    expect(p, end, '[');
+    skipSpace(p, end);
+    if(p < end && *p == ']'){   p++;    }
+    else{
+        int row = 0;
+        do{
+            expect(p, end, '[');
+            if(matrixType == "sparse"){
+                int otu = (int)parseNumber(p, end);     expect(p, end, ',');
+                int sample = (int)parseNumber(p, end);  expect(p, end, ',');
+                int count = (int)floor(parseNumber(p, end) + 0.5);
+                expect(p, end, ']');
+
+                if(otu < 0 || otu >= numOTUs || sample < 0 || sample >= numSamples){   jsonError("entry outside the table shape"); }
+                otus.push_back(otu);
+                samples.push_back(sample);
+                counts.push_back(count);
+            }
+            else{
+                if(row >= numOTUs){ jsonError("more data rows than ids");  }
+                int column = 0;
+                do{
+                    int count = (int)floor(parseNumber(p, end) + 0.5);
+                    if(count != 0 && column < numSamples){
+                        otus.push_back(row);
+                        samples.push_back(column);
+                        counts.push_back(count);
+                    }
+                    column++;
+                }while(nextElement(p, end, ']'));
+            }
+            row++;
+        }while(nextElement(p, end, ']'));
+    }
+
+    return new SparseCountMatrix(numSamples, numOTUs, samples, otus, counts);
+}
+
+/**************************************************************************************************/
+
+//names for a MatrixMarket table come from optional <file>.otus and <file>.samples files with one name per
+//line; without them the rows and columns are numbered
+
+static void readNames(string fileName, int numNames, string prefix, vector<string>& names){
+
+    ifstream nameFile(fileName.c_str());
+    string name;
+
+    while(nameFile && (int)names.size() < numNames){
+        string line = getline(nameFile);
+        stringstream lineStream(line);
+        if(lineStream >> name){ names.push_back(name);  }
+    }
+    for(int i=(int)names.size();i<numNames;i++){
+        names.push_back(prefix + toString(i+1));
+    }
+}
+
+/**************************************************************************************************/
+
+//coordinate MatrixMarket file with otus as rows and samples as columns, the same orientation as BIOM
+
+SparseCountMatrix* readMatrixMarketFile(string fileName, vector<string>& otuNames, vector<string>& sampleNames){
+
+    string contents = readWholeFile(fileName);
+    const char* p = contents.c_str();
+    const char* end = p + contents.size();
+
+    if(contents.compare(0, 14, "%%MatrixMarket") != 0 || contents.find("coordinate") > contents.find('\n')){
+        throw inputError(fileName + " is not a coordinate MatrixMarket file");
+    }
+    bool pattern = contents.find("pattern") < contents.find('\n');
+
+    //skip the banner and comments
+    while(p < end && *p == '%'){
+        while(p < end && *p != '\n'){   p++;    }
+        p++;
+    }
+
+    //the size line: rows (otus), columns (samples) and entries
+    char* next;
+    long size[3];
+    for(int i=0;i<3;i++){
+        size[i] = strtol(p, &next, 10);
+        if(next == p || size[i] < 0){   throw inputError(fileName + " has no valid size line"); }
+        p = next;
+    }
+    int numOTUs = (int)size[0];
+    int numSamples = (int)size[1];
+    long numEntries = size[2];
+
+    vector<int> samples, otus, counts;
+    samples.reserve(numEntries);
+    otus.reserve(numEntries);
+    counts.reserve(numEntries);
+
+    //an entry that cannot be parsed means the file ends before its declared number of entries
+    for(long i=0;i<numEntries;i++){
+        int otu = (int)strtol(p, &next, 10) - 1;
+        if(next == p){  throw inputError(fileName + " has fewer entries than its header declares");  }
+        p = next;
+
+        int sample = (int)strtol(p, &next, 10) - 1;
+        if(next == p){  throw inputError(fileName + " has fewer entries than its header declares");  }
+        p = next;
+
+        int count = 1;
+        if(!pattern){
+            count = (int)floor(strtod(p, &next) + 0.5);
+            if(next == p){  throw inputError(fileName + " has fewer entries than its header declares");  }
+            p = next;
+        }
+
+        if(otu < 0 || otu >= numOTUs || sample < 0 || sample >= numSamples){
+            throw inputError(fileName + " has an entry outside the table shape");
+        }
+        otus.push_back(otu);
+        samples.push_back(sample);
+        counts.push_back(count);
+    }
+
+    readNames(fileName + ".otus", numOTUs, "Otu", otuNames);
+    readNames(fileName + ".samples", numSamples, "Sample", sampleNames);
+
+    return new SparseCountMatrix(numSamples, numOTUs, samples, otus, counts);
+}
+
+/**************************************************************************************************/
+
+//BIOM and MatrixMarket tables are read straight into sparse rows; with a memory budget (bytes) a shared
+//file stays on disk in a chunk file in chunkDirectory and is streamed through the fit in blocks. otherwise
+//the shared file is read into sharedMatrix and NULL is returned
+
+CountSource* readCountFile(string sharedFileName, string chunkDirectory, double memoryBudget, vector<vector<int> >& sharedMatrix, vector<string>& otuNames, vector<string>& sampleNames){
+
+    string extension = (sharedFileName == "-") ? "" : sharedFileName.substr(sharedFileName.find_last_of(".")+1);
+
+    if(extension == "biom")     {   return readBiomFile(sharedFileName, otuNames, sampleNames);            }
+    else if(extension == "mtx") {   return readMatrixMarketFile(sharedFileName, otuNames, sampleNames);    }
+    else if(memoryBudget > 0)   {   return new ChunkedCountFile(sharedFileName, chunkDirectory, memoryBudget, otuNames, sampleNames);    }
+
+    readSharedFile(sharedFileName, sharedMatrix, otuNames, sampleNames);
+    return NULL;
+}
+
+/**************************************************************************************************/
+
+//a weighted sample of the rows that stands in for the whole table (a lightweight coreset): rows are drawn
+//with replacement with probability w/2W + 1/2 w d^2 / sum(w d^2), where w is the row weight, W their total
+//and d the distance between the row's relative abundances and the mean relative abundance that kMeans
+//starts from. a row drawn c times gets weight c w / (size * probability), so weighted sums over the coreset
+//are unbiased estimates of those over the source. members gets the source row of every coreset row
+
+SparseCountMatrix* buildCoreset(CountSource& source, int size, unsigned int seed, vector<int>& members){
+
+    int numSamples = source.getNumSamples();
+    int numOTUs = source.getNumOTUs();
+
+    //the mean relative abundance
+    vector<double> center(numOTUs, 0.0000);
+    vector<double> rowWeight(numSamples, 0.0000);
+    double totalWeight = 0.0000;
+
+    source.rewind();
+    while(const countBlock* block = source.nextBlock()){
+        for(int row=0;row<block->numSamples;row++){
+            double weight = block->getWeight(row);
+            for(int k=block->rowStart[row];k<block->rowStart[row+1];k++){
+                center[block->otus[k]] += weight * block->counts[k] / (double)block->totals[row];
+            }
+            rowWeight[block->firstSample + row] = weight;
+            totalWeight += weight;
+        }
+    }
+    for(int j=0;j<numOTUs;j++){ center[j] /= totalWeight;   }
+
+    double centerNorm = 0.0000;
+    for(int j=0;j<numOTUs;j++){ centerNorm += center[j] * center[j];    }
+
+    vector<double> distance(numSamples, 0.0000);
+    double totalDistance = 0.0000;
+
+    source.rewind();
+    while(const countBlock* block = source.nextBlock()){
+        for(int row=0;row<block->numSamples;row++){
+            double groupTotal = (double)block->totals[row];
+            double relAbundNorm = 0.0000;
+            double crossProduct = 0.0000;
+            for(int k=block->rowStart[row];k<block->rowStart[row+1];k++){
+                double relAbund = block->counts[k] / groupTotal;
+                relAbundNorm += relAbund * relAbund;
+                crossProduct += relAbund * center[block->otus[k]];
+            }
+            int sample = block->firstSample + row;
+            distance[sample] = max(0.0, relAbundNorm - 2.0 * crossProduct + centerNorm);
+            totalDistance += rowWeight[sample] * distance[sample];
+        }
+    }
+
+    vector<double> probability(numSamples);
+    for(int i=0;i<numSamples;i++){
+        double uniform = rowWeight[i] / totalWeight;
+        probability[i] = 0.5 * uniform + 0.5 * ((totalDistance > 0) ? rowWeight[i] * distance[i] / totalDistance : uniform);
+    }
+
+    mt19937 randomGenerator(seed);
+    discrete_distribution<int> draw(probability.begin(), probability.end());
+
+    vector<int> draws(numSamples, 0);
+    for(int i=0;i<size;i++){    draws[draw(randomGenerator)]++; }
+
+    vector<int> coresetRow(numSamples, -1);
+    vector<double> weights;
+    members.clear();
+    for(int i=0;i<numSamples;i++){
+        if(draws[i] == 0){  continue;   }
+        coresetRow[i] = (int)members.size();
+        members.push_back(i);
+        weights.push_back(draws[i] * rowWeight[i] / (size * probability[i]));
+    }
+
+    vector<int> samples, otus, counts;
+    source.rewind();
+    while(const countBlock* block = source.nextBlock()){
+        for(int row=0;row<block->numSamples;row++){
+            int coresetSample = coresetRow[block->firstSample + row];
+            if(coresetSample == -1){    continue;   }
+
+            for(int k=block->rowStart[row];k<block->rowStart[row+1];k++){
+                samples.push_back(coresetSample);
+                otus.push_back(block->otus[k]);
+                counts.push_back(block->counts[k]);
+            }
+        }
+    }
+
+    SparseCountMatrix* coreset = new SparseCountMatrix((int)members.size(), numOTUs, samples, otus, counts);
+    coreset->setSampleWeights(weights);
+    return coreset;
+}
+
+/**************************************************************************************************/
+
+//identical count rows are merged into one row whose weight is the sum of theirs, so every kernel visits
+//each distinct row once. rowOf gets the collapsed row of every source row and firstRow the first source
+//row of every collapsed row
+
+SparseCountMatrix* collapseRows(CountSource& source, vector<int>& rowOf, vector<int>& firstRow){
+
+    int numOTUs = source.getNumOTUs();
+
+    map<vector<int>, int> rowIndex;
+    vector<int> samples, otus, counts;
+    vector<double> weights;
+    vector<int> key;
+
+    rowOf.assign(source.getNumSamples(), -1);
+    firstRow.clear();
+
+    source.rewind();
+    while(const countBlock* block = source.nextBlock()){
+        for(int row=0;row<block->numSamples;row++){
+            key.clear();
+            for(int k=block->rowStart[row];k<block->rowStart[row+1];k++){
+                key.push_back(block->otus[k]);
+                key.push_back(block->counts[k]);
+            }
+
+            map<vector<int>, int>::iterator it = rowIndex.find(key);
+            int collapsedRow;
+
+            if(it == rowIndex.end()){
+                collapsedRow = (int)weights.size();
+                rowIndex[key] = collapsedRow;
+                firstRow.push_back(block->firstSample + row);
+                weights.push_back(0.0000);
+
+                for(int k=block->rowStart[row];k<block->rowStart[row+1];k++){
+                    samples.push_back(collapsedRow);
+                    otus.push_back(block->otus[k]);
+                    counts.push_back(block->counts[k]);
+                }
+            }
+            else{
+                collapsedRow = it->second;
+            }
+
+            weights[collapsedRow] += block->getWeight(row);
+            rowOf[block->firstSample + row] = collapsedRow;
+        }
+    }
+
+    SparseCountMatrix* collapsed = new SparseCountMatrix((int)weights.size(), numOTUs, samples, otus, counts);
+    collapsed->setSampleWeights(weights);
+    return collapsed;
+}
+
+/**************************************************************************************************/
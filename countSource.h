@@ -0,0 +1,196 @@
+//
+//  countSource.h
+//  pds_dmm
+//
+//  Copyright (c) 2012 University of Michigan. All rights reserved.
+//
+
+#ifndef pds_dmm_countSource_h
+#define pds_dmm_countSource_h
+
+/**************************************************************************************************/
+
+#include "pds_dmm.h"
+
+/**************************************************************************************************/
+
+//consecutive samples in compressed sparse row form; the nonzero counts of sample firstSample+i are
+//otus/counts[rowStart[i]..rowStart[i+1]). a row with weight w stands for w samples; weights is empty
+//when every row counts once
+
+struct countBlock {
+
+    int firstSample;
+    int numSamples;
+    vector<int> rowStart;
+    vector<int> otus;
+    vector<int> counts;
+    vector<int> totals;
+    vector<double> weights;
+
+    double getWeight(int row) const {   return weights.empty() ? 1.0000 : weights[row];    }
+
+};
+
+/**************************************************************************************************/
+
+//count data that is visited in passes of sample blocks rather than held as a dense matrix
+
+class CountSource {
+
+public:
+    virtual ~CountSource() {}
+
+    virtual int getNumSamples() = 0;
+    virtual int getNumOTUs() = 0;
+
+    //starts a new pass; nextBlock returns NULL at the end of the pass and the block stays valid
+    //until the next call
+    virtual void rewind() = 0;
+    virtual const countBlock* nextBlock() = 0;
+
+    //per sample weights that replace those of the blocks, or NULL; only the fits read them
+    virtual const vector<double>* getSampleWeights()    {   return NULL;    }
+
+};
+
+/**************************************************************************************************/
+
+//out-of-core counts: the shared file is converted once into sparse rows in a temporary file and then read
+//back in blocks no larger than the memory budget
+
+class ChunkedCountFile : public CountSource {
+
+public:
+    ChunkedCountFile(string, string, double, vector<string>&, vector<string>&);
+    ~ChunkedCountFile();
+
+    int getNumSamples()     {   return numSamples;  }
+    int getNumOTUs()        {   return numOTUs;     }
+
+    void rewind();
+    const countBlock* nextBlock();
+
+private:
+    string chunkFileName;
+    ifstream chunkFile;
+    countBlock block;
+
+    int numSamples;
+    int numOTUs;
+    int nextSample;
+    size_t maxBlockEntries;
+
+};
+
+/**************************************************************************************************/
+
+//a single pass over a shared file (or stdin for "-") a block of rows at a time, for data that is only
+//read once and never needs to be held whole
+
+class SharedFileReader {
+
+public:
+    SharedFileReader(string, int);
+
+    vector<string>& getOTUNames()   {   return otuNames;    }
+    const countBlock* nextBlock(vector<string>&);
+
+private:
+    ifstream inFile;
+    istream* sharedFile;
+    countBlock block;
+    vector<string> otuNames;
+
+    int blockSize;
+    int nextSample;
+
+};
+
+/**************************************************************************************************/
+
+//sparse counts held in memory as one compressed sparse row block, built from (sample, otu, count)
+//entries in time proportional to the number of nonzeros
+
+class SparseCountMatrix : public CountSource {
+
+public:
+    SparseCountMatrix(int, int, vector<int>&, vector<int>&, vector<int>&);
+    SparseCountMatrix(const vector<vector<int> >&);
+
+    int getNumSamples()     {   return numSamples;  }
+    int getNumOTUs()        {   return numOTUs;     }
+
+    void rewind()           {   finished = false;   }
+    const countBlock* nextBlock();
+
+    const countBlock& getBlock()    {   return block;   }
+    void setSampleWeights(vector<double>& w)    {   block.weights = w;  }
+
+private:
+    countBlock block;
+
+    int numSamples;
+    int numOTUs;
+    bool finished;
+
+};
+
+/**************************************************************************************************/
+
+//a pass over a block owned by someone else; every view keeps its own position, so concurrent fits can
+//share one block without copying it
+
+class CountBlockView : public CountSource {
+
+public:
+    CountBlockView(const countBlock& b, int o) : block(b), numOTUs(o), finished(false) {}
+
+    int getNumSamples()     {   return block.numSamples;    }
+    int getNumOTUs()        {   return numOTUs;             }
+
+    void rewind()           {   finished = false;   }
+    const countBlock* nextBlock();
+
+private:
+    const countBlock& block;
+
+    int numOTUs;
+    bool finished;
+
+};
+
+/**************************************************************************************************/
+
+//another source with sample i counted weights[i] times; the counts are read through the source and never
+//copied, so bootstrap replicates of one table cost only their weights
+
+class ReweightedSource : public CountSource {
+
+public:
+    ReweightedSource(CountSource& s, const vector<double>& w) : source(s), weights(w) {}
+
+    int getNumSamples()     {   return source.getNumSamples();  }
+    int getNumOTUs()        {   return source.getNumOTUs();     }
+
+    void rewind()                               {   source.rewind();            }
+    const countBlock* nextBlock()               {   return source.nextBlock();  }
+    const vector<double>* getSampleWeights()    {   return &weights;            }
+
+private:
+    CountSource& source;
+    const vector<double>& weights;
+
+};
+
+/**************************************************************************************************/
+
+SparseCountMatrix* readBiomFile(string, vector<string>&, vector<string>&);
+SparseCountMatrix* readMatrixMarketFile(string, vector<string>&, vector<string>&);
+CountSource* readCountFile(string, string, double, vector<vector<int> >&, vector<string>&, vector<string>&);
+SparseCountMatrix* buildCoreset(CountSource&, int, unsigned int, vector<int>&);
+SparseCountMatrix* collapseRows(CountSource&, vector<int>&, vector<int>&);
+
+/**************************************************************************************************/
+
+#endif
@@ -0,0 +1,792 @@
+//
+//  dmmResults.cpp
+//  pds_dmm
+//
+//  Copyright (c) 2012 University of Michigan. All rights reserved.
+//
+
+#include "dmmResults.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/**************************************************************************************************/
+
+//values are packed byte by byte so the files are little-endian whatever the host order is
+
+static void putUInt32(char* buffer, uint32_t value){
+    for(int i=0;i<4;i++){   buffer[i] = (char)((value >> (8 * i)) & 0xFF);  }
+}
+
+static void putUInt64(char* buffer, uint64_t value){
+    for(int i=0;i<8;i++){   buffer[i] = (char)((value >> (8 * i)) & 0xFF);  }
+}
+
+static void putDouble(char* buffer, double value){
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(double));
+    putUInt64(buffer, bits);
+}
+
+static uint32_t getUInt32(const char* buffer){
+    uint32_t value = 0;
+    for(int i=0;i<4;i++){   value |= (uint32_t)(unsigned char)buffer[i] << (8 * i); }
+    return value;
+}
+
+static uint64_t getUInt64(const char* buffer){
+    uint64_t value = 0;
+    for(int i=0;i<8;i++){   value |= (uint64_t)(unsigned char)buffer[i] << (8 * i); }
+    return value;
+}
+
+static double getDouble(const char* buffer){
+    uint64_t bits = getUInt64(buffer);
+    double value;
+    memcpy(&value, &bits, sizeof(double));
+    return value;
+}
+
+static uint64_t alignOffset(uint64_t offset){
+    return (offset + 63) & ~(uint64_t)63;
+}
+
+/**************************************************************************************************/
+
+static void writePadding(ofstream& outFile, uint64_t& position, uint64_t offset){
+    while(position < offset){
+        outFile.put('\0');
+        position++;
+    }
+}
+
+/**************************************************************************************************/
+
+//an array waiting to be written; exactly one of the source pointers is set
+
+struct pendingArray {
+
+    binaryArray array;
+    vector<vector<double> >* matrix;
+    vector<int>* integers;
+    vector<string>* strings;
+
+};
+
+/**************************************************************************************************/
+
+static void addArray(vector<pendingArray>& arrays, string name, vector<vector<double> >& matrix, int rows, int cols){
+
+    pendingArray pending;
+    pending.array.name = name;
+    pending.array.type = binaryFloat64;
+    pending.array.rows = rows;
+    pending.array.cols = cols;
+    pending.matrix = &matrix;
+    pending.integers = NULL;
+    pending.strings = NULL;
+    arrays.push_back(pending);
+}
+
+/**************************************************************************************************/
+
+static void addArray(vector<pendingArray>& arrays, string name, vector<int>& integers){
+
+    pendingArray pending;
+    pending.array.name = name;
+    pending.array.type = binaryInt32;
+    pending.array.rows = 1;
+    pending.array.cols = (uint32_t)integers.size();
+    pending.matrix = NULL;
+    pending.integers = &integers;
+    pending.strings = NULL;
+    arrays.push_back(pending);
+}
+
+/**************************************************************************************************/
+
+static void addArray(vector<pendingArray>& arrays, string name, vector<string>& strings){
+
+    uint64_t size = 0;
+    for(int i=0;i<strings.size();i++){  size += strings[i].size() + 1;  }
+
+    pendingArray pending;
+    pending.array.name = name;
+    pending.array.type = binaryStrings;
+    pending.array.rows = (uint32_t)strings.size();
+    pending.array.cols = (uint32_t)size;
+    pending.matrix = NULL;
+    pending.integers = NULL;
+    pending.strings = &strings;
+    arrays.push_back(pending);
+}
+
+/**************************************************************************************************/
+
+static void writeBinaryFile(string, dmmResults&, vector<pendingArray>&);
+
+/**************************************************************************************************/
+
+static void writeArray(ofstream& outFile, uint64_t& position, pendingArray& pending){
+
+    if(pending.matrix != NULL){
+        vector<vector<double> >& matrix = *pending.matrix;
+        for(int i=0;i<matrix.size();i++){
+            vector<char> buffer(matrix[i].size() * sizeof(double));
+            for(int j=0;j<matrix[i].size();j++){
+                putDouble(&buffer[j * sizeof(double)], matrix[i][j]);
+            }
+            if(!buffer.empty()){    outFile.write(&buffer[0], buffer.size());   }
+            position += buffer.size();
+        }
+    }
+    else if(pending.integers != NULL){
+        vector<int>& integers = *pending.integers;
+        vector<char> buffer(integers.size() * 4);
+        for(int i=0;i<integers.size();i++){
+            putUInt32(&buffer[i * 4], (uint32_t)integers[i]);
+        }
+        if(!buffer.empty()){    outFile.write(&buffer[0], buffer.size());   }
+        position += buffer.size();
+    }
+    else{
+        vector<string>& strings = *pending.strings;
+        for(int i=0;i<strings.size();i++){
+            outFile.write(strings[i].c_str(), strings[i].size() + 1);
+        }
+        position += pending.array.cols;
+    }
+}
+
+/**************************************************************************************************/
+
+//the partitions of a sample with the largest posteriors, best first; the top partition is always kept
+//so that every sample can still be assigned
+
+vector<pair<int, double> > getTopPosteriors(vector<vector<double> >& zMatrix, int sample, int topK, double threshold){
+
+    int numPartitions = (int)zMatrix.size();
+    vector<pair<int, double> > posteriors;
+
+    for(int i=0;i<numPartitions;i++){
+        posteriors.push_back(pair<int, double>(i, zMatrix[i][sample]));
+    }
+
+    int numKept = min(topK, numPartitions);
+    partial_sort(posteriors.begin(), posteriors.begin() + numKept, posteriors.end(), posteriorFunction);
+    posteriors.resize(numKept);
+
+    int numAbove = 1;
+    while(numAbove < numKept && posteriors[numAbove].second >= threshold){  numAbove++; }
+    posteriors.resize(numAbove);
+
+    return posteriors;
+}
+
+/**************************************************************************************************/
+
+void printZMatrix(ostream& printMatrix, dmmResults& results, vector<string>& sampleNames){
+
+    printMatrix.setf(ios::fixed, ios::floatfield);
+    printMatrix.setf(ios::showpoint);
+
+    for(int i=0;i<results.numPartitions;i++){   printMatrix << "\tPartition_" << i+1;   }   printMatrix << endl;
+
+    for(int i=0;i<results.numSamples;i++){
+        printMatrix << sampleNames[i];
+        for(int j=0;j<results.numPartitions;j++){
+            printMatrix << setprecision(4) << '\t' << results.zMatrix[j][i];
+        }
+        printMatrix << endl;
+    }
+}
+
+/**************************************************************************************************/
+
+//one line per retained (sample, partition) pair rather than a full numSamples x numPartitions table
+
+void printSparseZMatrix(ostream& printMatrix, dmmResults& results, vector<string>& sampleNames, int topK, double threshold){
+
+    printMatrix.setf(ios::fixed, ios::floatfield);
+    printMatrix.setf(ios::showpoint);
+
+    printMatrix << "Group\tPartition\tPosterior" << endl;
+
+    for(int i=0;i<results.numSamples;i++){
+        vector<pair<int, double> > posteriors = getTopPosteriors(results.zMatrix, i, topK, threshold);
+        for(int j=0;j<posteriors.size();j++){
+            printMatrix << sampleNames[i] << "\tPartition_" << posteriors[j].first+1 << '\t' << setprecision(4) << posteriors[j].second << endl;
+        }
+    }
+}
+
+/**************************************************************************************************/
+
+void printRelAbund(ostream& printRA, dmmResults& results, vector<string>& otuNames){
+
+    printRA.setf(ios::fixed, ios::floatfield);
+    printRA.setf(ios::showpoint);
+
+    vector<double> totals = getPartitionTotals(results);
+
+    printRA << "Taxon";
+    for(int i=0;i<results.numPartitions;i++){
+        printRA << "\tPartition_" << i+1 << '_' << setprecision(4) << totals[i];
+        printRA << "\tPartition_" << i+1 <<"_LCI" << "\tPartition_" << i+1 << "_UCI";
+    }
+    printRA << endl;
+
+    for(int i=0;i<results.numOTUs;i++){
+
+        printRA << otuNames[i];
+        for(int j=0;j<results.numPartitions;j++){
+            double mean, lci, uci;
+
+            if(getRelAbund(results, totals, j, i, mean, lci, uci)){
+                printRA << '\t' << mean << '\t' << lci << '\t' << uci;
+            }
+            else{
+                printRA << '\t' << mean << '\t' << "NA" << '\t' << "NA";
+            }
+        }
+        printRA << endl;
+    }
+}
+
+/**************************************************************************************************/
+
+//writes every per-K file requested for one fit; fileRoot already carries the K
+
+void writeResults(string fileRoot, dmmResults& results, vector<string>& sampleNames, vector<string>& otuNames, outputSettings& settings){
+
+    if(settings.writeText){
+        ofstream posteriorFile((fileRoot+"mix.posterior").c_str());
+        if(settings.topK == 0)  {   printZMatrix(posteriorFile, results, sampleNames);                                              }
+        else                    {   printSparseZMatrix(posteriorFile, results, sampleNames, settings.topK, settings.minPosterior);  }
+        posteriorFile.close();
+
+        ofstream relAbundFile((fileRoot+"mix.relabund").c_str());
+        printRelAbund(relAbundFile, results, otuNames);
+        relAbundFile.close();
+    }
+    if(settings.writeBinary){
+        writeBinaryResults(fileRoot+"mix.bin", results, sampleNames, otuNames, settings.topK, settings.minPosterior);
+    }
+    if(settings.saveModel){
+        writeModelFile(fileRoot+"mix.model", results, otuNames);
+    }
+    if(settings.writeStream){
+        cout << streamSectionMarker << fileRoot << "mix.posterior" << endl;
+        if(settings.topK == 0)  {   printZMatrix(cout, results, sampleNames);                                               }
+        else                    {   printSparseZMatrix(cout, results, sampleNames, settings.topK, settings.minPosterior);   }
+
+        cout << streamSectionMarker << fileRoot << "mix.relabund" << endl;
+        printRelAbund(cout, results, otuNames);
+        cout.flush();
+    }
+}
+
+/**************************************************************************************************/
+
+//topK of 0 keeps the dense zMatrix; otherwise only each sample's top posteriors are stored
+
+void writeBinaryResults(string fileName, dmmResults& results, vector<string>& sampleNames, vector<string>& otuNames, int topK, double threshold){
+
+    vector<pendingArray> arrays;
+    vector<vector<double> > weights(1, results.weights);
+
+    vector<int> zRows, zPartitions;
+    vector<vector<double> > zPosteriors(1);
+
+    addArray(arrays, "weights", weights, 1, results.numPartitions);
+
+    if(topK == 0){
+        addArray(arrays, "zMatrix", results.zMatrix, results.numPartitions, results.numSamples);
+    }
+    else{
+        zRows.push_back(0);
+        for(int i=0;i<results.numSamples;i++){
+            vector<pair<int, double> > posteriors = getTopPosteriors(results.zMatrix, i, topK, threshold);
+            for(int j=0;j<posteriors.size();j++){
+                zPartitions.push_back(posteriors[j].first);
+                zPosteriors[0].push_back(posteriors[j].second);
+            }
+            zRows.push_back((int)zPartitions.size());
+        }
+        addArray(arrays, "zRows", zRows);
+        addArray(arrays, "zPartitions", zPartitions);
+        addArray(arrays, "zPosteriors", zPosteriors, 1, (int)zPartitions.size());
+    }
+
+    addArray(arrays, "lambdaMatrix", results.lambdaMatrix, results.numPartitions, results.numOTUs);
+    addArray(arrays, "error", results.error, results.numPartitions, results.numOTUs);
+    addArray(arrays, "sampleNames", sampleNames);
+    addArray(arrays, "otuNames", otuNames);
+
+    writeBinaryFile(fileName, results, arrays);
+}
+
+/**************************************************************************************************/
+
+//everything needed to assign new samples: the weights, lambdas and errors of the fit and the OTU names
+
+void writeModelFile(string fileName, dmmResults& results, vector<string>& otuNames){
+
+    vector<pendingArray> arrays;
+    vector<vector<double> > weights(1, results.weights);
+
+    addArray(arrays, "weights", weights, 1, results.numPartitions);
+    addArray(arrays, "lambdaMatrix", results.lambdaMatrix, results.numPartitions, results.numOTUs);
+    addArray(arrays, "error", results.error, results.numPartitions, results.numOTUs);
+    addArray(arrays, "otuNames", otuNames);
+
+    writeBinaryFile(fileName, results, arrays);
+}
+
+/**************************************************************************************************/
+
+static void writeBinaryFile(string fileName, dmmResults& results, vector<pendingArray>& arrays){
+
+    uint64_t offset = binaryHeaderSize + binaryEntrySize * arrays.size();
+    for(int i=0;i<arrays.size();i++){
+        binaryArray& array = arrays[i].array;
+        offset = alignOffset(offset);
+        array.offset = offset;
+        if(array.type == binaryStrings)     {   offset += array.cols;                                           }
+        else if(array.type == binaryInt32)  {   offset += (uint64_t)array.rows * array.cols * 4;                }
+        else                                {   offset += (uint64_t)array.rows * array.cols * sizeof(double);   }
+    }
+
+    vector<char> header(binaryHeaderSize + binaryEntrySize * arrays.size(), '\0');
+
+    memcpy(&header[0], binaryResultsMagic, 8);
+    putUInt32(&header[8], binaryResultsVersion);
+    putUInt32(&header[12], (uint32_t)arrays.size());
+    putUInt32(&header[16], results.numPartitions);
+    putUInt32(&header[20], results.numSamples);
+    putUInt32(&header[24], results.numOTUs);
+    putDouble(&header[32], results.nll);
+    putDouble(&header[40], results.logDeterminant);
+    putDouble(&header[48], results.bic);
+    putDouble(&header[56], results.aic);
+    putDouble(&header[64], results.laplace);
+
+    for(int i=0;i<arrays.size();i++){
+        char* entry = &header[binaryHeaderSize + binaryEntrySize * i];
+        strncpy(entry, arrays[i].array.name.c_str(), 23);
+        putUInt32(entry + 24, arrays[i].array.type);
+        putUInt32(entry + 28, arrays[i].array.rows);
+        putUInt32(entry + 32, arrays[i].array.cols);
+        putUInt64(entry + 40, arrays[i].array.offset);
+    }
+
+    ofstream outFile(fileName.c_str(), ios::binary);
+    outFile.write(&header[0], header.size());
+    uint64_t position = header.size();
+
+    for(int i=0;i<arrays.size();i++){
+        writePadding(outFile, position, arrays[i].array.offset);
+        writeArray(outFile, position, arrays[i]);
+    }
+
+    outFile.close();
+}
+
+/**************************************************************************************************/
+
+dmmBinaryFile::dmmBinaryFile(string fileName) : data(NULL), size(0), numPartitions(0), numSamples(0), numOTUs(0) {
+
+    int fileDescriptor = open(fileName.c_str(), O_RDONLY);
+    if(fileDescriptor < 0){
+        cerr << "Error: could not open " << fileName << endl;
+        return;
+    }
+
+    struct stat fileStat;
+    if(fstat(fileDescriptor, &fileStat) != 0 || fileStat.st_size < binaryHeaderSize){
+        cerr << "Error: " << fileName << " is not a pds_dmm binary results file" << endl;
+        close(fileDescriptor);
+        return;
+    }
+    size = fileStat.st_size;
+
+    void* mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+    close(fileDescriptor);
+
+    if(mapped == MAP_FAILED){
+        cerr << "Error: could not map " << fileName << endl;
+        return;
+    }
+    data = (const char*)mapped;
+
+    uint32_t numArrays = getUInt32(data + 12);
+
+    if(memcmp(data, binaryResultsMagic, 8) != 0 || getUInt32(data + 8) != binaryResultsVersion ||
+       binaryHeaderSize + (uint64_t)binaryEntrySize * numArrays > size){
+        cerr << "Error: " << fileName << " is not a pds_dmm binary results file" << endl;
+        munmap((void*)data, size);
+        data = NULL;
+        return;
+    }
+
+    numPartitions = getUInt32(data + 16);
+    numSamples = getUInt32(data + 20);
+    numOTUs = getUInt32(data + 24);
+
+    for(int i=0;i<numArrays;i++){
+        const char* entry = data + binaryHeaderSize + binaryEntrySize * i;
+
+        binaryArray array;
+        array.name = string(entry, strnlen(entry, 24));
+        array.type = getUInt32(entry + 24);
+        array.rows = getUInt32(entry + 28);
+        array.cols = getUInt32(entry + 32);
+        array.offset = getUInt64(entry + 40);
+
+        uint64_t length = (array.type == binaryStrings) ? array.cols : (uint64_t)array.rows * array.cols * (array.type == binaryInt32 ? 4 : 8);
+        if(array.offset + length > size){
+            cerr << "Error: " << fileName << " is truncated" << endl;
+            munmap((void*)data, size);
+            data = NULL;
+            return;
+        }
+        arrays.push_back(array);
+    }
+}
+
+/**************************************************************************************************/
+
+dmmBinaryFile::~dmmBinaryFile(){
+    if(data != NULL){   munmap((void*)data, size);  }
+}
+
+/**************************************************************************************************/
+
+//0 = NLL, 1 = logDet, 2 = BIC, 3 = AIC, 4 = Laplace
+
+double dmmBinaryFile::getStatistic(int index){
+    return getDouble(data + 32 + 8 * index);
+}
+
+/**************************************************************************************************/
+
+bool dmmBinaryFile::hasArray(string name){
+    for(int i=0;i<arrays.size();i++){
+        if(arrays[i].name == name){ return true;    }
+    }
+    return false;
+}
+
+/**************************************************************************************************/
+
+binaryArray dmmBinaryFile::getArray(string name){
+    for(int i=0;i<arrays.size();i++){
+        if(arrays[i].name == name){ return arrays[i];   }
+    }
+
+    binaryArray missing;
+    missing.name = name;
+    missing.type = missing.rows = missing.cols = 0;
+    missing.offset = 0;
+    return missing;
+}
+
+/**************************************************************************************************/
+
+const char* dmmBinaryFile::getArrayData(string name){
+    binaryArray array = getArray(name);
+    if(array.type == 0){    return NULL;    }
+    return data + array.offset;
+}
+
+/**************************************************************************************************/
+
+vector<vector<double> > dmmBinaryFile::getMatrix(string name){
+
+    binaryArray array = getArray(name);
+    const char* values = data + array.offset;
+
+    vector<vector<double> > matrix(array.rows);
+    if(array.type != binaryFloat64){    return matrix;  }
+
+    for(int i=0;i<array.rows;i++){
+        matrix[i].resize(array.cols);
+        for(int j=0;j<array.cols;j++){
+            matrix[i][j] = getDouble(values);
+            values += sizeof(double);
+        }
+    }
+    return matrix;
+}
+
+/**************************************************************************************************/
+
+vector<int> dmmBinaryFile::getIntegers(string name){
+
+    binaryArray array = getArray(name);
+    vector<int> integers;
+    if(array.type != binaryInt32){  return integers;    }
+
+    const char* values = data + array.offset;
+    integers.resize((uint64_t)array.rows * array.cols);
+    for(int i=0;i<integers.size();i++){
+        integers[i] = (int)getUInt32(values + 4 * i);
+    }
+    return integers;
+}
+
+/**************************************************************************************************/
+
+vector<string> dmmBinaryFile::getStrings(string name){
+
+    binaryArray array = getArray(name);
+    vector<string> strings;
+    if(array.type != binaryStrings){    return strings; }
+
+    const char* values = data + array.offset;
+    const char* end = values + array.cols;
+
+    while(values < end && strings.size() < array.rows){
+        size_t length = strnlen(values, end - values);
+        strings.push_back(string(values, length));
+        values += length + 1;
+    }
+    return strings;
+}
+
+/**************************************************************************************************/
+
+bool readBinaryResults(string fileName, dmmResults& results, vector<string>& sampleNames, vector<string>& otuNames){
+
+    dmmBinaryFile binaryFile(fileName);
+    if(!binaryFile.isOpen()){   return false;   }
+
+    results.numPartitions = binaryFile.getNumPartitions();
+    results.numSamples = binaryFile.getNumSamples();
+    results.numOTUs = binaryFile.getNumOTUs();
+
+    results.nll = binaryFile.getStatistic(0);
+    results.logDeterminant = binaryFile.getStatistic(1);
+    results.bic = binaryFile.getStatistic(2);
+    results.aic = binaryFile.getStatistic(3);
+    results.laplace = binaryFile.getStatistic(4);
+
+    vector<vector<double> > weights = binaryFile.getMatrix("weights");
+    results.weights = weights.size() == 1 ? weights[0] : vector<double>(results.numPartitions, 0.0000);
+
+    if(binaryFile.hasArray("zMatrix")){
+        results.zMatrix = binaryFile.getMatrix("zMatrix");
+    }
+    else{
+        vector<int> zRows = binaryFile.getIntegers("zRows");
+        vector<int> zPartitions = binaryFile.getIntegers("zPartitions");
+        vector<vector<double> > zPosteriors = binaryFile.getMatrix("zPosteriors");
+
+        results.zMatrix.resize(results.numPartitions);
+        for(int i=0;i<results.numPartitions;i++){   results.zMatrix[i].assign(results.numSamples, 0.0000); }
+
+        for(int i=0;i<results.numSamples && i+1<zRows.size();i++){
+            for(int j=zRows[i];j<zRows[i+1];j++){
+                results.zMatrix[zPartitions[j]][i] = zPosteriors[0][j];
+            }
+        }
+    }
+    results.lambdaMatrix = binaryFile.getMatrix("lambdaMatrix");
+    results.error = binaryFile.getMatrix("error");
+
+    sampleNames = binaryFile.getStrings("sampleNames");
+    otuNames = binaryFile.getStrings("otuNames");
+
+    return true;
+}
+
+/**************************************************************************************************/
+
+//a fit of collapsed rows (see collapseRows) gives every sample the posteriors of the row it was merged into
+
+void expandSamples(dmmResults& results, const vector<int>& rowOf){
+
+    for(int i=0;i<results.numPartitions;i++){
+        vector<double> posteriors(rowOf.size());
+        for(int j=0;j<rowOf.size();j++){    posteriors[j] = results.zMatrix[i][rowOf[j]];   }
+        results.zMatrix[i].swap(posteriors);
+    }
+    results.numSamples = (int)rowOf.size();
+}
+
+/**************************************************************************************************/
+
+vector<double> getPartitionTotals(dmmResults& results){
+
+    vector<double> totals(results.numPartitions, 0.0000);
+    for(int i=0;i<results.numPartitions;i++){
+        for(int j=0;j<results.numOTUs;j++){
+            totals[i] += exp(results.lambdaMatrix[i][j]);
+        }
+    }
+    return totals;
+}
+
+/**************************************************************************************************/
+
+//relative abundance (%) of an otu in a partition with the +/- 2 standard deviation interval; returns
+//false when the hessian did not give a usable variance and the interval is not defined
+
+bool getRelAbund(dmmResults& results, vector<double>& totals, int partition, int otu, double& mean, double& lci, double& uci){
+
+    double lambda = results.lambdaMatrix[partition][otu];
+    mean = 100 * exp(lambda) / totals[partition];
+
+    if(results.error[partition][otu] >= 0.0000){
+        double std = sqrt(results.error[partition][otu]);
+        lci = 100 * exp(lambda - 2.0 * std) / totals[partition];
+        uci = 100 * exp(lambda + 2.0 * std) / totals[partition];
+        return true;
+    }
+
+    lci = uci = numeric_limits<double>::quiet_NaN();
+    return false;
+}
+
+/**************************************************************************************************/
+
+static void printInterval(ostream& outFile, double value){
+    if(isnan(value))    {   outFile << '\t' << "NA";    }
+    else                {   outFile << '\t' << value;   }
+}
+
+/**************************************************************************************************/
+
+//builds the mix.design, mix.parameters and mix.summary tables from the reference (K=1) and best fits
+
+void generateSummary(dmmResults& reference, dmmResults& best, vector<string>& otuNames, vector<string>& sampleNames, ostream& designFile, ostream& parameterFile, ostream& summaryFile){
+
+    int numPartitions = best.numPartitions;
+    int numSamples = best.numSamples;
+    int numOTUs = best.numOTUs;
+
+    vector<double> piValues(numPartitions, 0);
+
+    for(int i=0;i<numSamples;i++){
+        double maxPosterior = -1.0000;
+        int maxPartition = -1;
+
+        for(int j=0;j<numPartitions;j++){
+            if(best.zMatrix[j][i] > maxPosterior){
+                maxPosterior = best.zMatrix[j][i];
+                maxPartition = j;
+            }
+            piValues[j] += best.zMatrix[j][i];
+        }
+        designFile << sampleNames[i] << '\t' << "Partition_" << maxPartition+1 << endl;
+    }
+
+    for(int i=0;i<numPartitions;i++){
+        piValues[i] /= (double)numSamples;
+    }
+
+    vector<double> referenceTotals = getPartitionTotals(reference);
+    vector<double> totals = getPartitionTotals(best);
+
+    vector<string> thetaValues(numPartitions, "");
+    for(int i=0;i<numPartitions;i++){
+        stringstream theta;
+        theta.setf(ios::fixed, ios::floatfield);
+        theta.setf(ios::showpoint);
+        theta << setprecision(4) << totals[i];
+        thetaValues[i] = theta.str();
+    }
+
+    vector<summaryData> summary(numOTUs);
+    vector<double> partitionDiff(numPartitions, 0.0000);
+
+    for(int i=0;i<numOTUs;i++){
+        double lci, uci;
+
+        summary[i].name = otuNames[i];
+        getRelAbund(reference, referenceTotals, 0, i, summary[i].refMean, lci, uci);
+
+        summary[i].partMean.resize(numPartitions);
+        summary[i].partLCI.resize(numPartitions);
+        summary[i].partUCI.resize(numPartitions);
+        summary[i].difference = 0.0000;
+
+        for(int j=0;j<numPartitions;j++){
+            getRelAbund(best, totals, j, i, summary[i].partMean[j], summary[i].partLCI[j], summary[i].partUCI[j]);
+
+            double difference = abs(summary[i].refMean - summary[i].partMean[j]);
+            summary[i].difference += difference;
+            partitionDiff[j] += difference;
+        }
+    }
+
+    vector<int> order(numOTUs);
+    for(int i=0;i<numOTUs;i++){ order[i] = i;   }
+    sort(order.begin(), order.end(), summaryFunction(summary));
+
+    parameterFile.setf(ios::fixed, ios::floatfield);
+    parameterFile.setf(ios::showpoint);
+
+    double totalDifference =  0.0000;
+    parameterFile << "Part\tDif2Ref_i\ttheta_i\tpi_i\n";
+    for(int i=0;i<numPartitions;i++){
+        parameterFile << i+1 << '\t' << setprecision(2) << partitionDiff[i] << '\t' << thetaValues[i] << '\t' << piValues[i] << endl;
+        totalDifference += partitionDiff[i];
+    }
+
+    summaryFile.setf(ios::fixed, ios::floatfield);
+    summaryFile.setf(ios::showpoint);
+
+    summaryFile << "OTU\tP0.mean";
+    for(int i=0;i<numPartitions;i++){
+        summaryFile << "\tP" << i+1 << ".mean\tP" << i+1 << ".lci\tP" << i+1 << ".uci";
+    }
+    summaryFile << "\tDifference\tCumFraction" << endl;
+
+    double cumDiff = 0.0000;
+
+    for(int i=0;i<numOTUs;i++){
+        summaryData& otu = summary[order[i]];
+        
+        summaryFile << otu.name << setprecision(2) << '\t' << otu.refMean;
+        for(int j=0;j<numPartitions;j++){
+            summaryFile << '\t' << otu.partMean[j];
+            printInterval(summaryFile, otu.partLCI[j]);
+            printInterval(summaryFile, otu.partUCI[j]);
+        }
+
+        cumDiff += otu.difference/totalDifference;
+        summaryFile << '\t' << otu.difference << '\t' << cumDiff << endl;
+    }
+}
+
+/**************************************************************************************************/
+
+void generateSummaryFile(dmmResults& reference, dmmResults& best, vector<string>& otuNames, vector<string>& sampleNames, string fileRoot){
+
+    ofstream designFile((fileRoot + "mix.design").c_str());
+    ofstream parameterFile((fileRoot + "mix.parameters").c_str());
+    ofstream summaryFile((fileRoot + "mix.summary").c_str());
+
+    generateSummary(reference, best, otuNames, sampleNames, designFile, parameterFile, summaryFile);
+}
+
+/**************************************************************************************************/
+
+//the same three tables as sections of the result stream; parameters and summary are buffered so the
+//sections stay contiguous
+
+void streamSummary(dmmResults& reference, dmmResults& best, vector<string>& otuNames, vector<string>& sampleNames, string fileRoot){
+
+    stringstream designTable, parameterTable, summaryTable;
+    generateSummary(reference, best, otuNames, sampleNames, designTable, parameterTable, summaryTable);
+
+    cout << streamSectionMarker << fileRoot << "mix.design" << endl << designTable.str();
+    cout << streamSectionMarker << fileRoot << "mix.parameters" << endl << parameterTable.str();
+    cout << streamSectionMarker << fileRoot << "mix.summary" << endl << summaryTable.str();
+    cout.flush();
+}
+
+/**************************************************************************************************/
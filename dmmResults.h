@@ -0,0 +1,161 @@
+//
+//  dmmResults.h
+//  pds_dmm
+//
+//  Copyright (c) 2012 University of Michigan. All rights reserved.
+//
+
+#ifndef pds_dmm_dmmResults_h
+#define pds_dmm_dmmResults_h
+
+/**************************************************************************************************/
+
+#include "pds_dmm.h"
+
+#include <stdint.h>
+
+/**************************************************************************************************/
+
+//snapshot of everything a single fit produces; zMatrix is numPartitions x numSamples and
+//lambdaMatrix/error are numPartitions x numOTUs
+
+struct dmmResults {
+
+    int numPartitions;
+    int numSamples;
+    int numOTUs;
+
+    double nll;
+    double logDeterminant;
+    double bic;
+    double aic;
+    double laplace;
+
+    vector<double> weights;
+    vector<vector<double> > zMatrix;
+    vector<vector<double> > lambdaMatrix;
+    vector<vector<double> > error;
+
+};
+
+//which per-K files are written and how the posteriors are reduced; saveModel adds <root>Kmix.model
+
+struct outputSettings {
+
+    bool writeText;
+    bool writeBinary;
+    bool writeStream;
+    int topK;
+    double minPosterior;
+    bool saveModel;
+
+};
+
+/**************************************************************************************************/
+
+//binary results file (<root>Kmix.bin), all values little-endian:
+//
+//  offset  0   char[8]     magic "PDSDMM\0\0"
+//  offset  8   uint32      format version (1)
+//  offset 12   uint32      number of arrays
+//  offset 16   uint32      numPartitions
+//  offset 20   uint32      numSamples
+//  offset 24   uint32      numOTUs
+//  offset 32   float64 x5  NLL, logDet, BIC, AIC, Laplace
+//  offset 128  directory, one 48 byte entry per array:
+//                  char[24] name, uint32 type, uint32 rows, uint32 cols, uint32 unused, uint64 offset
+//
+//arrays are stored row-major starting on 64 byte boundaries so they can be mapped in place.
+//types are 1 (float64), 2 (int32) and 3 (string table: rows NUL-terminated strings in cols bytes)
+//
+//when only the top posteriors are kept, zMatrix is replaced by a compressed sparse row layout:
+//zRows (int32, numSamples+1 offsets), zPartitions (int32) and zPosteriors (float64)
+//
+//a saved model (<root>Kmix.model, written with -savemodel) is the same format holding only weights,
+//lambdaMatrix, error and otuNames; readBinaryResults reads either
+
+const char binaryResultsMagic[8] = {'P', 'D', 'S', 'D', 'M', 'M', '\0', '\0'};
+const uint32_t binaryResultsVersion = 1;
+const uint32_t binaryHeaderSize = 128;
+const uint32_t binaryEntrySize = 48;
+
+enum binaryArrayType { binaryFloat64 = 1, binaryInt32 = 2, binaryStrings = 3 };
+
+/**************************************************************************************************/
+
+//with -output stream every table goes to stdout instead of a file. each table is a section that starts
+//with a line holding the marker and the name of the file it replaces (e.g. "@@stdin.3mix.posterior"), so
+//a consumer can split the stream back into the usual files
+
+const string streamSectionMarker = "@@";
+
+/**************************************************************************************************/
+
+struct binaryArray {
+
+    string name;
+    uint32_t type;
+    uint32_t rows;
+    uint32_t cols;
+    uint64_t offset;
+
+};
+
+/**************************************************************************************************/
+
+//read-only view of a binary results file. the file is memory mapped and getArrayData points into the
+//mapping, so raw array access copies nothing; getMatrix, getIntegers and getStrings (and readBinaryResults,
+//which uses them) copy the values into vectors
+
+class dmmBinaryFile {
+
+public:
+    dmmBinaryFile(string);
+    ~dmmBinaryFile();
+
+    bool isOpen()               {   return data != NULL;    }
+    uint32_t getNumPartitions() {   return numPartitions;   }
+    uint32_t getNumSamples()    {   return numSamples;      }
+    uint32_t getNumOTUs()       {   return numOTUs;         }
+    double getStatistic(int);
+
+    bool hasArray(string);
+    binaryArray getArray(string);
+    const char* getArrayData(string);
+    vector<vector<double> > getMatrix(string);
+    vector<int> getIntegers(string);
+    vector<string> getStrings(string);
+
+private:
+    const char* data;
+    size_t size;
+
+    uint32_t numPartitions;
+    uint32_t numSamples;
+    uint32_t numOTUs;
+    vector<binaryArray> arrays;
+
+};
+
+/**************************************************************************************************/
+
+vector<pair<int, double> > getTopPosteriors(vector<vector<double> >&, int, int, double);
+
+void printZMatrix(ostream&, dmmResults&, vector<string>&);
+void printSparseZMatrix(ostream&, dmmResults&, vector<string>&, int, double);
+void printRelAbund(ostream&, dmmResults&, vector<string>&);
+void writeBinaryResults(string, dmmResults&, vector<string>&, vector<string>&, int, double);
+void writeModelFile(string, dmmResults&, vector<string>&);
+void writeResults(string, dmmResults&, vector<string>&, vector<string>&, outputSettings&);
+bool readBinaryResults(string, dmmResults&, vector<string>&, vector<string>&);
+void expandSamples(dmmResults&, const vector<int>&);
+
+vector<double> getPartitionTotals(dmmResults&);
+bool getRelAbund(dmmResults&, vector<double>&, int, int, double&, double&, double&);
+void generateSummary(dmmResults&, dmmResults&, vector<string>&, vector<string>&, ostream&, ostream&, ostream&);
+void generateSummaryFile(dmmResults&, dmmResults&, vector<string>&, vector<string>&, string);
+void streamSummary(dmmResults&, dmmResults&, vector<string>&, vector<string>&, string);
+
+/**************************************************************************************************/
+
+#endif
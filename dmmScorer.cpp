@@ -0,0 +1,153 @@
+//
+//  dmmScorer.cpp
+//  pds_dmm
+//
+//  Copyright (c) 2012 University of Michigan. All rights reserved.
+//
+
+#include "dmmScorer.h"
+
+/**************************************************************************************************/
+
+dmmScorer::dmmScorer(dmmResults& model, vector<string>& modelOTUs, vector<string>& dataOTUs) : numPartitions(model.numPartitions), numMatched(0) {
+
+    map<string, int> modelIndex;
+    for(int i=0;i<modelOTUs.size();i++){    modelIndex[modelOTUs[i]] = i;   }
+
+    otuMap.assign(dataOTUs.size(), -1);
+    for(int i=0;i<dataOTUs.size();i++){
+        map<string, int>::iterator it = modelIndex.find(dataOTUs[i]);
+        if(it != modelIndex.end()){
+            otuMap[i] = it->second;
+            numMatched++;
+        }
+    }
+
+    double totalWeight = 0.0000;
+    for(int k=0;k<numPartitions;k++){   totalWeight += model.weights[k];    }
+
+    logPi.resize(numPartitions);
+    alpha.resize(numPartitions);
+    lnGammaAlpha.resize(numPartitions);
+    sumAlpha.assign(numPartitions, 0.0000);
+    lnGammaSumAlpha.resize(numPartitions);
+
+    for(int k=0;k<numPartitions;k++){
+        logPi[k] = log(model.weights[k] / totalWeight);
+
+        alpha[k].resize(model.numOTUs);
+        lnGammaAlpha[k].resize(model.numOTUs);
+        for(int j=0;j<model.numOTUs;j++){
+            alpha[k][j] = exp(model.lambdaMatrix[k][j]);
+            lnGammaAlpha[k][j] = lgamma(alpha[k][j]);
+            sumAlpha[k] += alpha[k][j];
+        }
+        lnGammaSumAlpha[k] = lgamma(sumAlpha[k]);
+    }
+}
+
+/**************************************************************************************************/
+
+//one sample as numNonZero (data otu, count) pairs; fills the K posteriors and returns the log-likelihood.
+//zero counts contribute nothing once lgamma(alpha) is cancelled, so the cost is K x nonzeros. nothing is
+//written to the scorer, so many threads can score with one
+
+double dmmScorer::scoreSample(const int* otus, const int* counts, int numNonZero, vector<double>& posteriors) const {
+
+    double total = 0.0000;
+    double factor = 0.0000;
+
+    for(int i=0;i<numNonZero;i++){
+        if(otuMap[otus[i]] == -1){  continue;   }
+
+        total += counts[i];
+        factor += lgamma(counts[i] + 1.0000);
+    }
+    factor -= lgamma(total + 1.0);
+
+    posteriors.resize(numPartitions);
+    double offset = -numeric_limits<double>::max();
+
+    for(int k=0;k<numPartitions;k++){
+        double logStore = lnGammaSumAlpha[k] - lgamma(sumAlpha[k] + total) - factor;
+
+        for(int i=0;i<numNonZero;i++){
+            int otu = otuMap[otus[i]];
+            if(otu == -1 || counts[i] == 0){    continue;   }
+
+            logStore += lgamma(alpha[k][otu] + counts[i]) - lnGammaAlpha[k][otu];
+        }
+
+        posteriors[k] = logPi[k] + logStore;
+        if(posteriors[k] > offset){ offset = posteriors[k]; }
+    }
+
+    double sum = 0.0000;
+    for(int k=0;k<numPartitions;k++){
+        posteriors[k] = exp(posteriors[k] - offset);
+        sum += posteriors[k];
+    }
+    for(int k=0;k<numPartitions;k++){   posteriors[k] /= sum;   }
+
+    return log(sum) + offset;
+}
+
+/**************************************************************************************************/
+
+double dmmScorer::scoreSample(const vector<int>& counts, vector<double>& posteriors) const {
+
+    vector<int> otus, nonZero;
+    for(int j=0;j<counts.size();j++){
+        if(counts[j] != 0){
+            otus.push_back(j);
+            nonZero.push_back(counts[j]);
+        }
+    }
+
+    return scoreSample(otus.empty() ? NULL : &otus[0], nonZero.empty() ? NULL : &nonZero[0], (int)otus.size(), posteriors);
+}
+
+/**************************************************************************************************/
+
+//scores every sample, filling zMatrix (numPartitions x numSamples), and returns the total log-likelihood
+
+double dmmScorer::scoreCounts(const vector<vector<int> >& countMatrix, vector<vector<double> >& zMatrix) const {
+
+    int numSamples = (int)countMatrix.size();
+    zMatrix.assign(numPartitions, vector<double>(numSamples, 0.0000));
+
+    double logLikelihood = 0.0000;
+    vector<double> posteriors;
+
+    for(int i=0;i<numSamples;i++){
+        logLikelihood += scoreSample(countMatrix[i], posteriors);
+        for(int k=0;k<numPartitions;k++){   zMatrix[k][i] = posteriors[k];  }
+    }
+
+    return logLikelihood;
+}
+
+/**************************************************************************************************/
+
+double dmmScorer::scoreCounts(CountSource& source, vector<vector<double> >& zMatrix) const {
+
+    zMatrix.assign(numPartitions, vector<double>(source.getNumSamples(), 0.0000));
+
+    double logLikelihood = 0.0000;
+    vector<double> posteriors;
+
+    source.rewind();
+    while(const countBlock* block = source.nextBlock()){
+        for(int i=0;i<block->numSamples;i++){
+            int start = block->rowStart[i];
+            int numNonZero = block->rowStart[i+1] - start;
+
+            logLikelihood += scoreSample(numNonZero ? &block->otus[start] : NULL, numNonZero ? &block->counts[start] : NULL, numNonZero, posteriors);
+            for(int k=0;k<numPartitions;k++){   zMatrix[k][block->firstSample + i] = posteriors[k]; }
+        }
+    }
+
+    return logLikelihood;
+}
+
+/**************************************************************************************************/
@@ -0,0 +1,50 @@
+//
+//  dmmScorer.h
+//  pds_dmm
+//
+//  Copyright (c) 2012 University of Michigan. All rights reserved.
+//
+
+#ifndef pds_dmm_dmmScorer_h
+#define pds_dmm_dmmScorer_h
+
+/**************************************************************************************************/
+
+#include "dmmResults.h"
+#include "countSource.h"
+
+/**************************************************************************************************/
+
+//assigns new samples to the partitions of a finished fit. the data's OTUs are matched to the model's
+//by name; counts for OTUs the model has never seen are dropped and model OTUs missing from the data
+//count as zero. the log-likelihood of a sample matches the per-sample term of the fit's NLL
+
+class dmmScorer {
+
+public:
+    dmmScorer(dmmResults&, vector<string>&, vector<string>&);
+
+    int getNumPartitions() const    {   return numPartitions;   }
+    int getNumMatched() const       {   return numMatched;      }
+
+    double scoreSample(const int*, const int*, int, vector<double>&) const;
+    double scoreSample(const vector<int>&, vector<double>&) const;
+    double scoreCounts(const vector<vector<int> >&, vector<vector<double> >&) const;
+    double scoreCounts(CountSource&, vector<vector<double> >&) const;
+
+private:
+    int numPartitions;
+    int numMatched;
+
+    vector<int> otuMap;
+    vector<double> logPi;
+    vector<vector<double> > alpha;
+    vector<vector<double> > lnGammaAlpha;
+    vector<double> sumAlpha;
+    vector<double> lnGammaSumAlpha;
+
+};
+
+/**************************************************************************************************/
+
+#endif
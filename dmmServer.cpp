@@ -0,0 +1,380 @@
+//
+//  dmmServer.cpp
+//  pds_dmm
+//
+//  Copyright (c) 2012 University of Michigan. All rights reserved.
+//
+
+#include "dmmServer.h"
+
+#include <thread>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**************************************************************************************************/
+
+dmmServer::dmmServer(string s, dmmOptions o, outputSettings os) : socketPath(s), listenSocket(-1), stopping(false), options(o), settings(os) {
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    if(socketPath.size() >= sizeof(address.sun_path)){
+        cerr << "Error: socket path " << socketPath << " is too long." << endl;
+        exit(1);
+    }
+    strcpy(address.sun_path, socketPath.c_str());
+
+    //only a stale socket is replaced; anything else at the path is left alone
+    struct stat status;
+    if(lstat(socketPath.c_str(), &status) == 0){
+        if(!S_ISSOCK(status.st_mode)){
+            cerr << "Error: " << socketPath << " exists and is not a socket." << endl;
+            exit(1);
+        }
+        unlink(socketPath.c_str());
+    }
+
+    listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listenSocket == -1 || ::bind(listenSocket, (sockaddr*)&address, sizeof(address)) != 0 || listen(listenSocket, 16) != 0){
+        cerr << "Error: could not listen on " << socketPath << endl;
+        exit(1);
+    }
+}
+
+/**************************************************************************************************/
+
+dmmServer::~dmmServer(){
+
+    if(listenSocket != -1){ close(listenSocket);    }
+    unlink(socketPath.c_str());
+}
+
+/**************************************************************************************************/
+
+//connections are served on detached threads; datasets are shared pointers so a request that is still
+//running keeps its dataset alive after an unload. run only returns once every connection has closed:
+//idle ones are woken by shutting down their read side, busy ones finish the request they are on
+
+void dmmServer::run(){
+
+    cerr << "listening on " << socketPath << endl;
+
+    while(!stopping){
+        int connection = accept(listenSocket, NULL, NULL);
+        if(connection == -1){
+            if(stopping){   break;  }
+            continue;
+        }
+
+        lock_guard<mutex> lock(connectionLock);
+        connections.insert(connection);
+        thread(&dmmServer::serve, this, connection).detach();
+    }
+
+    unique_lock<mutex> lock(connectionLock);
+    for(set<int>::iterator it=connections.begin();it!=connections.end();it++){  shutdown(*it, SHUT_RD);  }
+    connectionsClosed.wait(lock, [this](){  return connections.empty(); });
+}
+
+/**************************************************************************************************/
+
+void dmmServer::serve(int connection){
+
+    string buffer;
+    char chunk[4096];
+    bool done = false;
+
+    while(!done){
+        ssize_t numRead = read(connection, chunk, sizeof(chunk));
+        if(numRead <= 0){   break;  }
+        buffer.append(chunk, numRead);
+
+        size_t lineEnd;
+        while(!done && (lineEnd = buffer.find('\n')) != string::npos){
+            string request = buffer.substr(0, lineEnd);
+            buffer.erase(0, lineEnd + 1);
+
+            //a request that fails in any way only gets an error reply
+            string reply;
+            try{
+                reply = handleRequest(request, done);
+            }
+            catch(exception& e){    reply = "error " + string(e.what()) + "\n";    }
+
+            //a client that hung up only ends its own connection, so the reply must not raise SIGPIPE
+            size_t numWritten = 0;
+            while(numWritten < reply.size()){
+                ssize_t n = send(connection, reply.data() + numWritten, reply.size() - numWritten, MSG_NOSIGNAL);
+                if(n <= 0){ done = true;    break;  }
+                numWritten += n;
+            }
+        }
+    }
+    //closing the listening socket wakes the accept in run()
+    if(stopping){   shutdown(listenSocket, SHUT_RDWR); }
+
+    //the last use of the server, which run() may destroy as soon as the lock is released
+    lock_guard<mutex> lock(connectionLock);
+    close(connection);
+    connections.erase(connection);
+    connectionsClosed.notify_all();
+}
+
+/**************************************************************************************************/
+
+string dmmServer::handleRequest(string request, bool& done){
+
+    stringstream words(request);
+    string command, name, fileName;
+    int numPartitions = 0;
+
+    if(!(words >> command)){    return "error empty request\n"; }
+
+    if(command == "load"){
+        if(!(words >> name >> fileName)){   return "error usage: load <name> <file>\n"; }
+        return load(name, fileName);
+    }
+    else if(command == "fit"){
+        if(!(words >> name >> numPartitions) || numPartitions < 1){ return "error usage: fit <name> <K> [fileRoot]\n"; }
+        words >> fileName;
+        return fit(name, numPartitions, fileName);
+    }
+    else if(command == "design"){
+        if(!(words >> name >> fileName)){   return "error usage: design <name> <designFile>\n"; }
+        return design(name, fileName);
+    }
+    else if(command == "score"){
+        if(!(words >> name >> numPartitions >> fileName)){  return "error usage: score <name> <K> <file>\n";    }
+        return score(name, numPartitions, fileName);
+    }
+    else if(command == "unload"){
+        if(!(words >> name)){   return "error usage: unload <name>\n";  }
+        return unload(name);
+    }
+    else if(command == "list"){
+        return list();
+    }
+    else if(command == "quit"){
+        done = true;
+        return "ok\n";
+    }
+    else if(command == "shutdown"){
+        done = true;
+        stopping = true;
+        return "ok\n";
+    }
+
+    return "error unknown command " + command + "\n";
+}
+
+/**************************************************************************************************/
+
+static string getFitReply(int numPartitions, dmmResults& results){
+
+    stringstream line;
+    line.setf(ios::fixed, ios::floatfield);
+    line.setf(ios::showpoint);
+
+    line << "ok\t1" << endl;
+    line << numPartitions << '\t';
+    line << setprecision (2) << results.nll << '\t' << results.logDeterminant << '\t';
+    line << results.bic << '\t' << results.aic << '\t' << results.laplace << endl;
+
+    return line.str();
+}
+
+/**************************************************************************************************/
+
+shared_ptr<serverDataset> dmmServer::getDataset(string name){
+
+    lock_guard<mutex> lock(datasetLock);
+
+    map<string, shared_ptr<serverDataset> >::iterator it = datasets.find(name);
+    if(it == datasets.end()){   return shared_ptr<serverDataset>(); }
+    return it->second;
+}
+
+/**************************************************************************************************/
+
+string dmmServer::load(string name, string fileName){
+
+    ifstream testFile(fileName.c_str());
+    if(!testFile){  return "error could not open " + fileName + "\n";   }
+    testFile.close();
+
+    shared_ptr<serverDataset> dataset(new serverDataset());
+    try{
+        dataset->sparseMatrix = (SparseCountMatrix*)readCountFile(fileName, "", 0, dataset->sharedMatrix, dataset->otuNames, dataset->sampleNames);
+    }
+    catch(inputError& e){   return "error " + string(e.what()) + "\n";  }
+
+    //the fits index the first row and OTU, so an empty table is turned away here
+    if(dataset->sampleNames.empty() || dataset->otuNames.empty()){  return "error " + fileName + " has no samples or no OTUs\n"; }
+
+    {
+        lock_guard<mutex> lock(datasetLock);
+        datasets[name] = dataset;
+    }
+
+    return "ok\t1\n" + name + '\t' + toString(dataset->sampleNames.size()) + '\t' + toString(dataset->otuNames.size()) + "\n";
+}
+
+/**************************************************************************************************/
+
+static CountDataset getData(shared_ptr<serverDataset> dataset){
+
+    if(dataset->sparseMatrix != NULL){  return CountDataset(dataset->sparseMatrix->getBlock(), dataset->sampleNames, dataset->otuNames);    }
+    return CountDataset(dataset->sharedMatrix, dataset->sampleNames, dataset->otuNames);
+}
+
+/**************************************************************************************************/
+
+//returns an earlier fit of K partitions or fits one now. two requests for the same K may both fit;
+//the first to finish is kept
+
+void dmmServer::getModel(shared_ptr<serverDataset> dataset, int numPartitions, dmmResults& results){
+
+    {
+        lock_guard<mutex> lock(dataset->modelLock);
+        map<int, dmmResults>::iterator it = dataset->models.find(numPartitions);
+        if(it != dataset->models.end()){
+            results = it->second;
+            return;
+        }
+    }
+
+    results = ::fit(getData(dataset), numPartitions, options);
+
+    lock_guard<mutex> lock(dataset->modelLock);
+    dataset->models.insert(pair<int, dmmResults>(numPartitions, results));
+}
+
+/**************************************************************************************************/
+
+string dmmServer::fit(string name, int numPartitions, string fileRoot){
+
+    shared_ptr<serverDataset> dataset = getDataset(name);
+    if(!dataset){   return "error no dataset " + name + "\n";   }
+
+    dmmResults results;
+    getModel(dataset, numPartitions, results);
+
+    if(fileRoot != ""){
+        writeResults(fileRoot+toString(numPartitions), results, dataset->sampleNames, dataset->otuNames, settings);
+    }
+
+    return getFitReply(numPartitions, results);
+}
+
+/**************************************************************************************************/
+
+string dmmServer::design(string name, string designFileName){
+
+    shared_ptr<serverDataset> dataset = getDataset(name);
+    if(!dataset){   return "error no dataset " + name + "\n";   }
+
+    ifstream testFile(designFileName.c_str());
+    if(!testFile){  return "error could not open " + designFileName + "\n"; }
+    testFile.close();
+
+    vector<vector<double> > partitions;
+    try{
+        readDesignFile(designFileName, dataset->sampleNames, partitions);
+    }
+    catch(inputError& e){   return "error " + string(e.what()) + "\n";  }
+    if(partitions.empty()){ return "error " + designFileName + " names none of the samples of " + name + "\n";  }
+
+    dmmResults results = fitDesign(getData(dataset), partitions, options);
+
+    return getFitReply((int)partitions.size(), results);
+}
+
+/**************************************************************************************************/
+
+//one line per sample: name, most likely partition, its posterior and the sample's log-likelihood
+
+string dmmServer::score(string name, int numPartitions, string fileName){
+
+    shared_ptr<serverDataset> dataset = getDataset(name);
+    if(!dataset){   return "error no dataset " + name + "\n";   }
+
+    ifstream testFile(fileName.c_str());
+    if(!testFile){  return "error could not open " + fileName + "\n";   }
+    testFile.close();
+
+    dmmResults model;
+    getModel(dataset, numPartitions, model);
+
+    vector<vector<int> > sharedMatrix;
+    vector<string> otuNames, sampleNames;
+    SparseCountMatrix* sparseMatrix;
+    try{
+        sparseMatrix = (SparseCountMatrix*)readCountFile(fileName, "", 0, sharedMatrix, otuNames, sampleNames);
+    }
+    catch(inputError& e){   return "error " + string(e.what()) + "\n";  }
+
+    dmmScorer scorer(model, dataset->otuNames, otuNames);
+
+    stringstream reply;
+    reply.setf(ios::fixed, ios::floatfield);
+    reply.setf(ios::showpoint);
+    reply << "ok\t" << sampleNames.size() << endl;
+
+    vector<double> posteriors;
+    int numSamples = (int)sampleNames.size();
+    const countBlock* block = (sparseMatrix != NULL) ? sparseMatrix->nextBlock() : NULL;
+
+    for(int i=0;i<numSamples;i++){
+        double logLikelihood;
+        if(block != NULL){
+            int start = block->rowStart[i];
+            int numNonZero = block->rowStart[i+1] - start;
+            logLikelihood = scorer.scoreSample(numNonZero ? &block->otus[start] : NULL, numNonZero ? &block->counts[start] : NULL, numNonZero, posteriors);
+        }
+        else{
+            logLikelihood = scorer.scoreSample(sharedMatrix[i], posteriors);
+        }
+
+        int best = (int)(max_element(posteriors.begin(), posteriors.end()) - posteriors.begin());
+        reply << sampleNames[i] << "\tPartition_" << best+1 << '\t' << setprecision(4) << posteriors[best] << '\t' << setprecision(2) << logLikelihood << endl;
+    }
+    delete sparseMatrix;
+
+    return reply.str();
+}
+
+/**************************************************************************************************/
+
+string dmmServer::unload(string name){
+
+    lock_guard<mutex> lock(datasetLock);
+    if(datasets.erase(name) == 0){  return "error no dataset " + name + "\n";   }
+    return "ok\n";
+}
+
+/**************************************************************************************************/
+
+string dmmServer::list(){
+
+    lock_guard<mutex> lock(datasetLock);
+
+    stringstream reply;
+    reply << "ok\t" << datasets.size() << endl;
+
+    for(map<string, shared_ptr<serverDataset> >::iterator it=datasets.begin();it!=datasets.end();it++){
+        reply << it->first << '\t' << it->second->sampleNames.size() << '\t' << it->second->otuNames.size();
+
+        lock_guard<mutex> modelLock(it->second->modelLock);
+        for(map<int, dmmResults>::iterator model=it->second->models.begin();model!=it->second->models.end();model++){
+            reply << '\t' << model->first;
+        }
+        reply << endl;
+    }
+
+    return reply.str();
+}
+
+/**************************************************************************************************/
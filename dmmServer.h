@@ -0,0 +1,99 @@
+//
+//  dmmServer.h
+//  pds_dmm
+//
+//  Copyright (c) 2012 University of Michigan. All rights reserved.
+//
+
+#ifndef pds_dmm_dmmServer_h
+#define pds_dmm_dmmServer_h
+
+/**************************************************************************************************/
+
+#include "libpdsdmm.h"
+#include "dmmScorer.h"
+
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <set>
+#include <condition_variable>
+
+/**************************************************************************************************/
+
+//long-lived process that keeps parsed datasets and their fitted models in memory and answers requests
+//on a Unix domain socket. requests are single lines of whitespace separated words:
+//
+//  load <name> <file>              parse a shared/BIOM/MatrixMarket file and keep it as <name>
+//  fit <name> <K> [fileRoot]       fit K partitions (or reuse an earlier fit); with fileRoot the usual
+//                                  per-K files are written to <fileRoot><K>mix.*
+//  design <name> <designFile>      fit the partitions given in a design file
+//  score <name> <K> <file>         assign the samples in file to the partitions of the K fit
+//  unload <name>                   forget a dataset and its models
+//  list                            the loaded datasets and their fitted K
+//  quit                            close this connection
+//  shutdown                        stop the server
+//
+//every reply starts with "ok" or "error <message>"; an ok followed by a line count is followed by that
+//many lines: load answers with one "name samples OTUs" line, fit and design with one "K NLE logDet BIC
+//AIC Laplace" line. a file that cannot be read, or any other failed request, gets an error reply and the
+//server keeps running. each connection is served on its own thread
+
+struct serverDataset {
+
+    vector<vector<int> > sharedMatrix;
+    SparseCountMatrix* sparseMatrix;
+    vector<string> otuNames;
+    vector<string> sampleNames;
+
+    map<int, dmmResults> models;
+    mutex modelLock;
+
+    serverDataset() : sparseMatrix(NULL) {}
+    ~serverDataset()    {   delete sparseMatrix;    }
+
+};
+
+/**************************************************************************************************/
+
+class dmmServer {
+
+public:
+    dmmServer(string, dmmOptions, outputSettings);
+    ~dmmServer();
+
+    void run();
+
+private:
+    void serve(int);
+    string handleRequest(string, bool&);
+
+    string load(string, string);
+    string fit(string, int, string);
+    string design(string, string);
+    string score(string, int, string);
+    string unload(string);
+    string list();
+
+    shared_ptr<serverDataset> getDataset(string);
+    void getModel(shared_ptr<serverDataset>, int, dmmResults&);
+
+    string socketPath;
+    int listenSocket;
+    atomic<bool> stopping;
+
+    set<int> connections;
+    mutex connectionLock;
+    condition_variable connectionsClosed;
+
+    dmmOptions options;
+    outputSettings settings;
+
+    map<string, shared_ptr<serverDataset> > datasets;
+    mutex datasetLock;
+
+};
+
+/**************************************************************************************************/
+
+#endif
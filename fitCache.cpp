@@ -0,0 +1,183 @@
+//
+//  fitCache.cpp
+//  pds_dmm
+//
+//  Copyright (c) 2012 University of Michigan. All rights reserved.
+//
+
+#include "fitCache.h"
+
+#include <sys/stat.h>
+#include <errno.h>
+#include <unistd.h>
+#include <thread>
+
+/**************************************************************************************************/
+
+//64 bit FNV-1a
+
+static const uint64_t fnvOffset = 14695981039346656037ULL;
+static const uint64_t fnvPrime = 1099511628211ULL;
+
+static uint64_t hashBytes(uint64_t hash, const void* data, size_t length){
+    const unsigned char* bytes = (const unsigned char*)data;
+    for(size_t i=0;i<length;i++){
+        hash ^= bytes[i];
+        hash *= fnvPrime;
+    }
+    return hash;
+}
+
+static uint64_t hashValue(uint64_t hash, int64_t value){
+    unsigned char bytes[8];
+    for(int i=0;i<8;i++){   bytes[i] = (unsigned char)((uint64_t)value >> (8 * i)); }
+    return hashBytes(hash, bytes, 8);
+}
+
+static uint64_t hashValue(uint64_t hash, double value){
+    int64_t bits;
+    memcpy(&bits, &value, sizeof(double));
+    return hashValue(hash, bits);
+}
+
+/**************************************************************************************************/
+
+//the data hash covers the nonzero (otu, count) pairs of each sample so dense and streamed inputs of the
+//same table share cache entries; row weights other than 1 are hashed with their row
+
+fitCache::fitCache(string d, vector<vector<int> >& countMatrix){
+
+    initialize(d);
+
+    numSamples = (int)countMatrix.size();
+    numOTUs = numSamples > 0 ? (int)countMatrix[0].size() : 0;
+
+    vector<int> otus, counts;
+    for(int i=0;i<numSamples;i++){
+        otus.clear();
+        counts.clear();
+        for(int j=0;j<countMatrix[i].size();j++){
+            if(countMatrix[i][j] != 0){
+                otus.push_back(j);
+                counts.push_back(countMatrix[i][j]);
+            }
+        }
+        addRow(otus, counts);
+    }
+}
+
+/**************************************************************************************************/
+
+fitCache::fitCache(string d, CountSource& source){
+
+    initialize(d);
+
+    numSamples = source.getNumSamples();
+    numOTUs = source.getNumOTUs();
+
+    vector<int> otus, counts;
+
+    source.rewind();
+    while(const countBlock* block = source.nextBlock()){
+        for(int row=0;row<block->numSamples;row++){
+            otus.assign(block->otus.begin() + block->rowStart[row], block->otus.begin() + block->rowStart[row+1]);
+            counts.assign(block->counts.begin() + block->rowStart[row], block->counts.begin() + block->rowStart[row+1]);
+            addRow(otus, counts);
+            if(block->getWeight(row) != 1.0000){    dataHash = hashValue(dataHash, block->getWeight(row));  }
+        }
+    }
+}
+
+/**************************************************************************************************/
+
+void fitCache::initialize(string d){
+
+    directory = d;
+    if(directory != "" && directory[directory.size()-1] != '/'){    directory += '/';   }
+
+    //a directory that cannot be made (or a file in its place) only turns caching off
+    struct stat status;
+    usable = (mkdir(directory.c_str(), 0755) == 0) || (errno == EEXIST && stat(directory.c_str(), &status) == 0 && S_ISDIR(status.st_mode));
+    if(!usable){
+        cerr << "Warning: could not create the fit cache directory " << directory << "; fits will not be cached" << endl;
+    }
+
+    dataHash = hashBytes(fnvOffset, "pds_dmm fit cache 1", 19);
+}
+
+/**************************************************************************************************/
+
+void fitCache::addRow(vector<int>& otus, vector<int>& counts){
+
+    dataHash = hashValue(dataHash, (int64_t)otus.size());
+    for(int i=0;i<otus.size();i++){
+        dataHash = hashValue(dataHash, (int64_t)otus[i]);
+        dataHash = hashValue(dataHash, (int64_t)counts[i]);
+    }
+}
+
+/**************************************************************************************************/
+
+string fitCache::getFileName(int numPartitions, const dmmOptions& options){
+
+    uint64_t hash = hashValue(dataHash, (int64_t)numSamples);
+    hash = hashValue(hash, (int64_t)numOTUs);
+    hash = hashValue(hash, (int64_t)numPartitions);
+    hash = hashValue(hash, (int64_t)options.seed);
+    hash = hashValue(hash, options.tolerance);
+    hash = hashValue(hash, (int64_t)options.maxIterations);
+    if(options.batchSize > 0){
+        hash = hashValue(hash, (int64_t)options.batchSize);
+        hash = hashValue(hash, (int64_t)options.stochasticPasses);
+        hash = hashValue(hash, (int64_t)options.finalPasses);
+    }
+    if(options.coresetSize > 0){
+        hash = hashValue(hash, (int64_t)options.coresetSize);
+        hash = hashValue(hash, (int64_t)options.refineIterations);
+    }
+    if(options.coarseOTUs > 0){ hash = hashValue(hash, (int64_t)options.coarseOTUs);    }
+    if(options.activeThreshold > 0){    hash = hashValue(hash, options.activeThreshold);    }
+    if(options.classificationEM){       hash = hashValue(hash, (int64_t)1);                 }
+
+    stringstream fileName;
+    fileName << directory << hex << setw(16) << setfill('0') << hash << ".bin";
+    return fileName.str();
+}
+
+/**************************************************************************************************/
+
+bool fitCache::load(int numPartitions, const dmmOptions& options, dmmResults& results){
+
+    if(!usable){    return false;   }
+
+    string fileName = getFileName(numPartitions, options);
+    if(access(fileName.c_str(), R_OK) != 0){    return false;   }
+
+    vector<string> sampleNames, otuNames;
+    if(!readBinaryResults(fileName, results, sampleNames, otuNames)){   return false;   }
+
+    return results.numPartitions == numPartitions && results.numSamples == numSamples && results.numOTUs == numOTUs;
+}
+
+/**************************************************************************************************/
+
+//entries are written under a temporary name and renamed so that concurrent runs (or threads) sharing a cache
+//never see a partial file
+
+void fitCache::store(int numPartitions, const dmmOptions& options, dmmResults& results){
+
+    if(!usable){    return; }
+
+    string fileName = getFileName(numPartitions, options);
+    string tempName = fileName + "." + toString(getpid()) + "." + toString(hash<thread::id>()(this_thread::get_id())) + ".tmp";
+
+    vector<string> sampleNames, otuNames;
+    writeBinaryResults(tempName, results, sampleNames, otuNames, 0, 0.0000);
+
+    if(rename(tempName.c_str(), fileName.c_str()) != 0){
+        cerr << "Warning: could not add " << fileName << " to the fit cache" << endl;
+        remove(tempName.c_str());
+    }
+}
+
+/**************************************************************************************************/
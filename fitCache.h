@@ -0,0 +1,44 @@
+//
+//  fitCache.h
+//  pds_dmm
+//
+//  Copyright (c) 2012 University of Michigan. All rights reserved.
+//
+
+#ifndef pds_dmm_fitCache_h
+#define pds_dmm_fitCache_h
+
+/**************************************************************************************************/
+
+#include "qFinderDMM.h"
+
+/**************************************************************************************************/
+
+//directory of finished fits stored as binary results files and named by a hash of the count data,
+//K and the fit options, so re-running a sweep on unchanged data only fits the K it has not seen
+
+class fitCache {
+
+public:
+    fitCache(string, vector<vector<int> >&);
+    fitCache(string, CountSource&);
+
+    bool load(int, const dmmOptions&, dmmResults&);
+    void store(int, const dmmOptions&, dmmResults&);
+
+private:
+    void initialize(string);
+    void addRow(vector<int>&, vector<int>&);
+    string getFileName(int, const dmmOptions&);
+
+    string directory;
+    bool usable;
+    uint64_t dataHash;
+    int numSamples;
+    int numOTUs;
+
+};
+
+/**************************************************************************************************/
+
+#endif
@@ -0,0 +1,771 @@
+//
+//  libpdsdmm.cpp
+//  pds_dmm
+//
+//  Copyright (c) 2012 University of Michigan. All rights reserved.
+//
+
+#include "libpdsdmm.h"
+#include "threadPool.h"
+#include "dmmScorer.h"
+
+/**************************************************************************************************/
+
+CountDataset::CountDataset(const vector<vector<int> >& c, const vector<string>& s, const vector<string>& o) : counts(&c), block(NULL), source(NULL), sampleNames(s), otuNames(o) {}
+
+CountDataset::CountDataset(const countBlock& b, const vector<string>& s, const vector<string>& o) : counts(NULL), block(&b), source(NULL), sampleNames(s), otuNames(o) {}
+
+CountDataset::CountDataset(CountSource& c, const vector<string>& s, const vector<string>& o) : counts(NULL), block(NULL), source(&c), sampleNames(s), otuNames(o) {}
+
+/**************************************************************************************************/
+
+//sparse blocks are read through a view of their own so concurrent fits never share a read position
+
+static dmmResults warmFit(const CountDataset& data, const dmmResults& start, const dmmOptions& options){
+
+    if(data.getCounts() != NULL){
+        qFinderDMM findQ(*data.getCounts(), start, options);
+        return findQ.getResults();
+    }
+    else if(data.getBlock() != NULL){
+        CountBlockView view(*data.getBlock(), data.getNumOTUs());
+        qFinderDMM findQ(view, start, options);
+        return findQ.getResults();
+    }
+
+    qFinderDMM findQ(*data.getSource(), start, options);
+    return findQ.getResults();
+}
+
+/**************************************************************************************************/
+
+//the rows of a dataset as a CountSource for the passes of the table transforms below; dense counts are
+//copied into sparse rows and blocks get a view, either of which the caller deletes through owned
+
+static CountSource* openRows(const CountDataset& data, CountSource*& owned){
+
+    owned = NULL;
+    if(data.getCounts() != NULL)        {   owned = new SparseCountMatrix(*data.getCounts());                   }
+    else if(data.getBlock() != NULL)    {   owned = new CountBlockView(*data.getBlock(), data.getNumOTUs());    }
+
+    return (owned != NULL) ? owned : data.getSource();
+}
+
+/**************************************************************************************************/
+
+static SparseCountMatrix* getCoreset(const CountDataset& data, const dmmOptions& options){
+
+    if(options.coresetSize <= 0 || options.coresetSize >= data.getNumSamples()){   return NULL;    }
+
+    vector<int> members;
+    CountSource* owned;
+    SparseCountMatrix* coreset = buildCoreset(*openRows(data, owned), options.coresetSize, options.seed, members);
+    delete owned;
+
+    return coreset;
+}
+
+/**************************************************************************************************/
+
+//dense counts are copied into sparse rows once when the fit has to read them on the statistics path, which
+//the coreset refinement and mini-batches do; NULL when the counts can be read as they are. fit() and sweep()
+//fit every K on the copy
+
+static SparseCountMatrix* getSparseRows(const CountDataset& data, const dmmOptions& options){
+
+    if(data.getCounts() == NULL || (options.coarseOTUs > 0 && options.coarseOTUs < data.getNumOTUs())){ return NULL;    }
+
+    bool useCoreset = options.coresetSize > 0 && options.coresetSize < data.getNumSamples();
+    if(useCoreset || options.batchSize > 0){    return new SparseCountMatrix(*data.getCounts());    }
+    return NULL;
+}
+
+/**************************************************************************************************/
+
+//the full EM runs on the weighted coreset and is then continued on all of the data for at most
+//refineIterations (but at least one) iterations, which also fills in the posteriors of every sample. the
+//refinement runs on the statistics path, so data holds sparse rows (see getSparseRows)
+
+static dmmResults fitCoreset(const CountDataset& data, SparseCountMatrix& coreset, int numPartitions, const dmmOptions& options){
+
+    dmmOptions refineOptions = options;
+    refineOptions.maxIterations = max(options.refineIterations, 1);
+
+    qFinderDMM findQ(coreset, numPartitions, options);
+    dmmResults start = findQ.getResults();
+    start.zMatrix.clear();
+
+    return warmFit(data, start, refineOptions);
+}
+
+/**************************************************************************************************/
+
+//the weighted total count, the weighted number of samples holding the otu and the summed relative
+//abundance of every otu
+
+static void getOTUTotals(CountSource& source, vector<double>& totals, vector<double>& prevalence, vector<double>& relAbund){
+
+    totals.assign(source.getNumOTUs(), 0.0000);
+    prevalence.assign(source.getNumOTUs(), 0.0000);
+    relAbund.assign(source.getNumOTUs(), 0.0000);
+
+    source.rewind();
+    while(const countBlock* block = source.nextBlock()){
+        for(int row=0;row<block->numSamples;row++){
+            double weight = block->getWeight(row);
+            for(int k=block->rowStart[row];k<block->rowStart[row+1];k++){
+                totals[block->otus[k]] += weight * block->counts[k];
+                prevalence[block->otus[k]] += weight;
+                relAbund[block->otus[k]] += weight * block->counts[k] / (double)block->totals[row];
+            }
+        }
+    }
+}
+
+/**************************************************************************************************/
+
+//the share of every otu in the total of its bin; dropped otus and otus without counts get 0
+
+static void setShares(otuMapping& mapping, vector<double>& totals){
+
+    vector<double> binTotals(mapping.binNames.size(), 0.0000);
+    for(int i=0;i<totals.size();i++){
+        if(mapping.binOf[i] != -1){ binTotals[mapping.binOf[i]] += totals[i];   }
+    }
+
+    mapping.share.assign(totals.size(), 0.0000);
+    for(int i=0;i<totals.size();i++){
+        int bin = mapping.binOf[i];
+        if(bin != -1 && binTotals[bin] > 0){    mapping.share[i] = totals[i] / binTotals[bin];  }
+    }
+}
+
+/**************************************************************************************************/
+
+//the numBins - 1 most abundant otus keep bins of their own and the rest are pooled into "Other"
+
+otuMapping getCoarseMapping(const CountDataset& data, int numBins){
+
+    CountSource* owned;
+    vector<double> totals, prevalence, relAbund;
+    getOTUTotals(*openRows(data, owned), totals, prevalence, relAbund);
+    delete owned;
+
+    int numOTUs = data.getNumOTUs();
+    vector<int> order(numOTUs);
+    for(int i=0;i<numOTUs;i++){ order[i] = i;   }
+    stable_sort(order.begin(), order.end(), [&](int a, int b){  return totals[a] > totals[b];   });
+
+    otuMapping mapping;
+    mapping.binOf.assign(numOTUs, numBins - 1);
+    for(int i=0;i<numBins-1;i++){
+        mapping.binOf[order[i]] = i;
+        mapping.binNames.push_back(data.getOTUNames()[order[i]]);
+    }
+    mapping.binNames.push_back("Other");
+
+    setShares(mapping, totals);
+    return mapping;
+}
+
+/**************************************************************************************************/
+
+//otus below any of the thresholds carry next to no information but each costs a parameter per partition;
+//they are dropped or, with pool set, summed into a bin named "Other". the other otus keep bins of their own
+//in their original order
+
+otuMapping getRareOTUMapping(const CountDataset& data, const otuFilter& filter){
+
+    CountSource* owned;
+    CountSource& source = *openRows(data, owned);
+    vector<double> totals, prevalence, relAbund;
+    getOTUTotals(source, totals, prevalence, relAbund);
+
+    double totalWeight = 0.0000;
+    source.rewind();
+    while(const countBlock* block = source.nextBlock()){
+        for(int row=0;row<block->numSamples;row++){ totalWeight += block->getWeight(row);   }
+    }
+    delete owned;
+
+    int numOTUs = data.getNumOTUs();
+    otuMapping mapping;
+    mapping.binOf.assign(numOTUs, -1);
+
+    vector<int> rare;
+    for(int i=0;i<numOTUs;i++){
+        bool keep = prevalence[i] >= filter.minPrevalence && totals[i] >= filter.minCount && totals[i] > 0;
+        if(totalWeight > 0){    keep = keep && relAbund[i] / totalWeight >= filter.minRelAbund; }
+
+        if(keep){
+            mapping.binOf[i] = (int)mapping.binNames.size();
+            mapping.binNames.push_back(data.getOTUNames()[i]);
+        }
+        else if(totals[i] > 0){
+            rare.push_back(i);
+        }
+    }
+
+    if(filter.pool && !rare.empty()){
+        for(int i=0;i<rare.size();i++){ mapping.binOf[rare[i]] = (int)mapping.binNames.size();   }
+        mapping.binNames.push_back("Other");
+    }
+
+    setShares(mapping, totals);
+    return mapping;
+}
+
+/**************************************************************************************************/
+
+//the table with the counts of every bin summed; rows keep their weights
+
+SparseCountMatrix* aggregateOTUs(const CountDataset& data, const otuMapping& mapping){
+
+    CountSource* owned;
+    CountSource& source = *openRows(data, owned);
+
+    vector<int> samples, otus, counts;
+    vector<double> weights(source.getNumSamples(), 1.0000);
+    bool weighted = false;
+
+    source.rewind();
+    while(const countBlock* block = source.nextBlock()){
+        for(int row=0;row<block->numSamples;row++){
+            int sample = block->firstSample + row;
+            weights[sample] = block->getWeight(row);
+            if(weights[sample] != 1.0000){  weighted = true;    }
+
+            //repeated bins within a row are summed when the matrix is built
+            for(int k=block->rowStart[row];k<block->rowStart[row+1];k++){
+                int bin = mapping.binOf[block->otus[k]];
+                if(bin == -1){  continue;   }
+                samples.push_back(sample);
+                otus.push_back(bin);
+                counts.push_back(block->counts[k]);
+            }
+        }
+    }
+
+    SparseCountMatrix* aggregated = new SparseCountMatrix(source.getNumSamples(), (int)mapping.binNames.size(), samples, otus, counts);
+    if(weighted){   aggregated->setSampleWeights(weights);  }
+
+    delete owned;
+    return aggregated;
+}
+
+/**************************************************************************************************/
+
+//a bin's alpha is the sum of the alphas of its otus (the Dirichlet aggregation property), so each otu gets
+//its share of it; otus that were dropped or never counted get the floor used for absent otus and an error
+//of -1, so their intervals are reported as NA. an otu pooled into a bin carries the bin's error, so its
+//interval is the bin's and not one of its own
+
+void expandOTUs(dmmResults& results, const otuMapping& mapping){
+
+    int numOTUs = (int)mapping.binOf.size();
+
+    for(int k=0;k<results.numPartitions;k++){
+        vector<double> lambda(numOTUs, -10.0);
+        vector<double> error(numOTUs, -1.0000);
+
+        for(int i=0;i<numOTUs;i++){
+            int bin = mapping.binOf[i];
+            if(bin == -1 || mapping.share[i] == 0){ continue;   }
+            lambda[i] = results.lambdaMatrix[k][bin] + log(mapping.share[i]);
+            if(!results.error.empty()){ error[i] = results.error[k][bin];   }
+        }
+
+        results.lambdaMatrix[k].swap(lambda);
+        if(!results.error.empty()){ results.error[k].swap(error);   }
+    }
+    results.numOTUs = numOTUs;
+}
+
+/**************************************************************************************************/
+
+//coarse-to-fine: the fit runs on the binned table and its lambdas, spread back over the otus, start the
+//EM at full resolution
+
+static dmmResults fitCoarse(const CountDataset& data, SparseCountMatrix& coarse, const otuMapping& mapping, int numPartitions, const dmmOptions& options){
+
+    dmmOptions coarseOptions = options;
+    coarseOptions.coarseOTUs = 0;
+
+    CountDataset coarseData(coarse.getBlock(), data.getSampleNames(), mapping.binNames);
+    dmmResults start = fit(coarseData, numPartitions, coarseOptions);
+
+    expandOTUs(start, mapping);
+    start.zMatrix.clear();
+
+    return warmFit(data, start, options);
+}
+
+/**************************************************************************************************/
+
+static SparseCountMatrix* getCoarseTable(const CountDataset& data, const dmmOptions& options, otuMapping& mapping){
+
+    if(options.coarseOTUs <= 0 || options.coarseOTUs >= data.getNumOTUs()){    return NULL;    }
+
+    mapping = getCoarseMapping(data, options.coarseOTUs);
+    return aggregateOTUs(data, mapping);
+}
+
+/**************************************************************************************************/
+
+dmmResults fit(const CountDataset& data, int numPartitions, const dmmOptions& options){
+
+    otuMapping mapping;
+    if(SparseCountMatrix* coarse = getCoarseTable(data, options, mapping)){
+        dmmResults results = fitCoarse(data, *coarse, mapping, numPartitions, options);
+        delete coarse;
+        return results;
+    }
+
+    if(SparseCountMatrix* sparse = getSparseRows(data, options)){
+        dmmResults results = fit(CountDataset(*sparse, data.getSampleNames(), data.getOTUNames()), numPartitions, options);
+        delete sparse;
+        return results;
+    }
+
+    if(SparseCountMatrix* coreset = getCoreset(data, options)){
+        dmmResults results = fitCoreset(data, *coreset, numPartitions, options);
+        delete coreset;
+        return results;
+    }
+
+    if(data.getCounts() != NULL){
+        qFinderDMM findQ(*data.getCounts(), numPartitions, options);
+        return findQ.getResults();
+    }
+    else if(data.getBlock() != NULL){
+        CountBlockView view(*data.getBlock(), data.getNumOTUs());
+        qFinderDMM findQ(view, numPartitions, options);
+        return findQ.getResults();
+    }
+
+    qFinderDMM findQ(*data.getSource(), numPartitions, options);
+    return findQ.getResults();
+}
+
+/**************************************************************************************************/
+
+//lines the previous model up with the data's OTUs by name; OTUs the model has not seen start at the
+//same floor the design fits use for absent OTUs
+
+static dmmResults alignModel(const dmmResults& previous, const vector<string>& previousOTUs, const vector<string>& otuNames){
+
+    map<string, int> previousIndex;
+    for(int i=0;i<previousOTUs.size();i++){ previousIndex[previousOTUs[i]] = i; }
+
+    dmmResults start;
+    start.numPartitions = previous.numPartitions;
+    start.numOTUs = (int)otuNames.size();
+    start.weights = previous.weights;
+    start.lambdaMatrix.assign(previous.numPartitions, vector<double>(otuNames.size(), -10.0));
+
+    for(int j=0;j<otuNames.size();j++){
+        map<string, int>::iterator it = previousIndex.find(otuNames[j]);
+        if(it == previousIndex.end()){  continue;   }
+
+        for(int k=0;k<previous.numPartitions;k++){  start.lambdaMatrix[k][j] = previous.lambdaMatrix[k][it->second];   }
+    }
+
+    return start;
+}
+
+/**************************************************************************************************/
+
+static vector<double> getPi(const dmmResults& results){
+
+    double total = 0.0000;
+    for(int k=0;k<results.numPartitions;k++){   total += results.weights[k];    }
+
+    vector<double> pi(results.numPartitions);
+    for(int k=0;k<results.numPartitions;k++){   pi[k] = results.weights[k] / total; }
+    return pi;
+}
+
+/**************************************************************************************************/
+
+static vector<double> getAbundances(const vector<double>& lambda){
+
+    vector<double> abundance(lambda.size());
+    double total = 0.0000;
+    for(int j=0;j<lambda.size();j++){
+        abundance[j] = exp(lambda[j]);
+        total += abundance[j];
+    }
+    for(int j=0;j<lambda.size();j++){   abundance[j] /= total;  }
+    return abundance;
+}
+
+/**************************************************************************************************/
+
+//warm-started EM from a previous fit, typically after samples were added; movement is filled with how
+//far each partition moved from where it started
+
+dmmResults refit(const CountDataset& data, const dmmResults& previous, const vector<string>& previousOTUs, const dmmOptions& options, refitMovement& movement){
+
+    dmmResults start = alignModel(previous, previousOTUs, data.getOTUNames());
+    dmmResults results = warmFit(data, start, options);
+
+    vector<double> startPi = getPi(start);
+    vector<double> pi = getPi(results);
+
+    movement.piChange.assign(results.numPartitions, 0.0000);
+    movement.abundanceDistance.assign(results.numPartitions, 0.0000);
+    movement.maxLambdaChange.assign(results.numPartitions, 0.0000);
+
+    for(int k=0;k<results.numPartitions;k++){
+        movement.piChange[k] = pi[k] - startPi[k];
+
+        vector<double> startAbundance = getAbundances(start.lambdaMatrix[k]);
+        vector<double> abundance = getAbundances(results.lambdaMatrix[k]);
+
+        for(int j=0;j<results.numOTUs;j++){
+            movement.abundanceDistance[k] += abs(abundance[j] - startAbundance[j]);
+            movement.maxLambdaChange[k] = max(movement.maxLambdaChange[k], abs(results.lambdaMatrix[k][j] - start.lambdaMatrix[k][j]));
+        }
+    }
+
+    return results;
+}
+
+/**************************************************************************************************/
+
+//partitions is numPartitions x numSamples, one column per sample as read by readDesignFile
+
+dmmResults fitDesign(const CountDataset& data, const vector<vector<double> >& partitions, const dmmOptions& options){
+
+    if(data.getCounts() != NULL){
+        qFinderDMM findQ(*data.getCounts(), partitions);
+        return findQ.getResults();
+    }
+    else if(data.getBlock() != NULL){
+        CountBlockView view(*data.getBlock(), data.getNumOTUs());
+        qFinderDMM findQ(view, partitions, options);
+        return findQ.getResults();
+    }
+
+    qFinderDMM findQ(*data.getSource(), partitions, options);
+    return findQ.getResults();
+}
+
+/**************************************************************************************************/
+
+void sweep(const CountDataset& data, const sweepOptions& settings, const dmmOptions& options, sweepCallback callback, dmmResults& reference, dmmResults& best){
+
+    double minLaplace = 1e10;
+    int minPartition = 0;
+    map<int, double> laplace;
+
+    //the binned table, the sparse copy of dense counts and the coreset are built once and shared by every K
+    otuMapping mapping;
+    SparseCountMatrix* coarse = getCoarseTable(data, options, mapping);
+    SparseCountMatrix* sparse = getSparseRows(data, options);
+    CountDataset rows = (sparse != NULL) ? CountDataset(*sparse, data.getSampleNames(), data.getOTUNames()) : data;
+    SparseCountMatrix* coreset = (coarse == NULL) ? getCoreset(rows, options) : NULL;
+
+    auto evaluate = [&](int numPartitions){
+        dmmResults results;
+
+        if(settings.cache == NULL || !settings.cache->load(numPartitions, options, results)){
+            if(coarse != NULL)          {   results = fitCoarse(data, *coarse, mapping, numPartitions, options);    }
+            else if(coreset != NULL)    {   results = fitCoreset(rows, *coreset, numPartitions, options);           }
+            else                        {   results = fit(rows, numPartitions, options);                            }
+            if(settings.cache != NULL){ settings.cache->store(numPartitions, options, results);  }
+        }
+
+        bool isBest = false;
+        laplace[numPartitions] = results.laplace;
+        if(numPartitions == 1){ reference = results;    }
+        if(results.laplace < minLaplace){
+            minPartition = numPartitions;
+            minLaplace = results.laplace;
+            best = results;
+            isBest = true;
+        }
+
+        callback(results, isBest);
+        return laplace[numPartitions];
+    };
+
+    if(!settings.adaptive){
+        for(int numPartitions=1;numPartitions<=settings.maxPartitions;numPartitions++){
+            evaluate(numPartitions);
+
+            if(settings.optimizeGap != -1 && (numPartitions - minPartition) >= settings.optimizeGap && numPartitions >= settings.minPartitions){ break;  }
+        }
+    }
+    else{
+        //doubling until the curve turns up brackets the minimum in (lower, upper); 0 and maxPartitions+1
+        //stand for ends that cannot be fit
+        int lower = 0, middle = 1, upper = settings.maxPartitions + 1;
+        double middleLaplace = evaluate(1);
+
+        while(middle < settings.maxPartitions){
+            int next = min(2 * middle, settings.maxPartitions);
+            if(evaluate(next) >= middleLaplace){
+                upper = next;
+                break;
+            }
+            lower = middle;
+            middle = next;
+            middleLaplace = laplace[next];
+        }
+
+        //golden-section steps into the larger side of the bracket until both neighbours of the middle are fit
+        while(middle - lower > 1 || upper - middle > 1){
+            int trial;
+            if(upper - middle >= middle - lower)    {   trial = middle + max(1, (int)(0.382 * (upper - middle) + 0.5)); }
+            else                                    {   trial = middle - max(1, (int)(0.382 * (middle - lower) + 0.5)); }
+
+            double trialLaplace = laplace.count(trial) ? laplace[trial] : evaluate(trial);
+            if(trialLaplace < middleLaplace){
+                if(trial > middle)  {   lower = middle; }
+                else                {   upper = middle; }
+                middle = trial;
+                middleLaplace = trialLaplace;
+            }
+            else{
+                if(trial > middle)  {   upper = trial;  }
+                else                {   lower = trial;  }
+            }
+        }
+
+        //the curve is noisy, so every K near the best is fit as well
+        int confirmed = 0;
+        while(confirmed != minPartition){
+            confirmed = minPartition;
+            for(int numPartitions=max(confirmed - settings.confirmWindow, 1);numPartitions<=min(confirmed + settings.confirmWindow, settings.maxPartitions);numPartitions++){
+                if(!laplace.count(numPartitions)){  evaluate(numPartitions);    }
+            }
+        }
+    }
+
+    delete coarse;
+    delete coreset;
+    delete sparse;
+}
+
+/**************************************************************************************************/
+
+//the design fitted to numPermutations random relabelings of its samples, processors at a time; every
+//permutation has its own seed (taken from the options seed), so the test is reproducible. all fits share
+//the one dataset, which therefore has to be dense or an in-memory block when processors is above 1. the
+//relative abundances of dense counts are computed once and read by every permutation
+
+vector<double> permuteDesign(const CountDataset& data, const vector<vector<double> >& partitions, int numPermutations, const dmmOptions& options, int processors){
+
+    vector<double> laplace(numPermutations, 0.0000);
+    if(data.getSource() != NULL){   processors = 1; }
+
+    vector<vector<double> > relativeAbundance;
+    if(data.getCounts() != NULL){   relativeAbundance = getRelativeAbundance(*data.getCounts());    }
+
+    int numSamples = data.getNumSamples();
+    threadPool pool(processors);
+
+    for(int p=0;p<numPermutations;p++){
+        pool.submit([&, p](){
+            mt19937 randomGenerator(options.seed + p);
+            vector<int> order(numSamples);
+            for(int i=0;i<numSamples;i++){  order[i] = i;   }
+            shuffle(order.begin(), order.end(), randomGenerator);
+
+            vector<vector<double> > permuted(partitions.size(), vector<double>(numSamples, 0.0000));
+            for(int k=0;k<partitions.size();k++){
+                for(int i=0;i<numSamples;i++){  permuted[k][i] = partitions[k][order[i]];  }
+            }
+
+            if(data.getCounts() != NULL){
+                qFinderDMM findQ(*data.getCounts(), relativeAbundance, permuted);
+                laplace[p] = findQ.getLaplace();
+            }
+            else{
+                laplace[p] = fitDesign(data, permuted, options).laplace;
+            }
+        }, 1.0);
+    }
+    pool.wait();
+
+    return laplace;
+}
+
+/**************************************************************************************************/
+
+//several designs over the same samples, fitted processors at a time; results come back in design order
+
+vector<dmmResults> fitDesigns(const CountDataset& data, const vector<vector<vector<double> > >& designs, const dmmOptions& options, int processors){
+
+    vector<dmmResults> results(designs.size());
+    if(data.getSource() != NULL){   processors = 1; }
+
+    threadPool pool(processors);
+    for(int c=0;c<designs.size();c++){
+        pool.submit([&, c](){   results[c] = fitDesign(data, designs[c], options);  }, (double)designs[c].size());
+    }
+    pool.wait();
+
+    return results;
+}
+
+/**************************************************************************************************/
+
+//the weight of every row of the dataset, as the fits see it without any reweighting; returns the total
+
+static double getRowWeights(const CountDataset& data, const countBlock* block, vector<double>& rowWeights){
+
+    rowWeights.assign(data.getNumSamples(), 1.0000);
+    double totalWeight = 0.0000;
+
+    CountSource* owned = NULL;
+    CountSource* rows = (block != NULL) ? (owned = new CountBlockView(*block, data.getNumOTUs())) : data.getSource();
+    rows->rewind();
+    while(const countBlock* b = rows->nextBlock()){
+        for(int row=0;row<b->numSamples;row++){
+            rowWeights[b->firstSample + row] = b->getWeight(row);
+            totalWeight += b->getWeight(row);
+        }
+    }
+    delete owned;
+
+    return totalWeight;
+}
+
+/**************************************************************************************************/
+
+//a fit of the rows (block, or the dataset's source when there is none) with every sample counted as often
+//as its weight says, on the statistics path and without any coreset or binning
+
+static dmmResults fitReweighted(const CountDataset& data, const countBlock* block, const vector<double>& weights, int numPartitions, const dmmOptions& options){
+
+    dmmOptions fitOptions = options;
+    fitOptions.coresetSize = 0;
+    fitOptions.coarseOTUs = 0;
+
+    CountBlockView* view = (block != NULL) ? new CountBlockView(*block, data.getNumOTUs()) : NULL;
+    ReweightedSource reweighted((view != NULL) ? *view : *data.getSource(), weights);
+
+    qFinderDMM findQ(reweighted, numPartitions, fitOptions);
+    dmmResults results = findQ.getResults();
+    delete view;
+
+    return results;
+}
+
+/**************************************************************************************************/
+
+//every replicate draws the samples with replacement (as many draws as the table's total weight, each row
+//in proportion to its weight) and keeps only the number of times each was drawn, which the fits take as
+//sample weights over the one shared table. every K of every replicate is its own task, processors at a
+//time; the replicates are seeded from the options seed
+
+bootstrapResults bootstrapSweep(const CountDataset& data, int numReplicates, int maxPartitions, const dmmOptions& options, int processors){
+
+    bootstrapResults results;
+    results.laplace.assign(numReplicates, vector<double>(maxPartitions, 0.0000));
+    results.bic.assign(numReplicates, vector<double>(maxPartitions, 0.0000));
+
+    //dense counts are converted once, every replicate reads the same rows
+    SparseCountMatrix* sparse = (data.getCounts() != NULL) ? new SparseCountMatrix(*data.getCounts()) : NULL;
+    const countBlock* block = (sparse != NULL) ? &sparse->getBlock() : data.getBlock();
+    if(block == NULL){  processors = 1; }
+
+    int numSamples = data.getNumSamples();
+    vector<double> rowWeights;
+    double totalWeight = getRowWeights(data, block, rowWeights);
+
+    vector<vector<double> > multiplicity(numReplicates, vector<double>(numSamples, 0.0000));
+    for(int b=0;b<numReplicates;b++){
+        mt19937 randomGenerator(options.seed + b);
+        discrete_distribution<int> draw(rowWeights.begin(), rowWeights.end());
+        int numDraws = (int)(totalWeight + 0.5);
+        for(int i=0;i<numDraws;i++){    multiplicity[b][draw(randomGenerator)] += 1.0000;    }
+    }
+
+    threadPool pool(processors);
+    for(int b=0;b<numReplicates;b++){
+        for(int numPartitions=1;numPartitions<=maxPartitions;numPartitions++){
+            pool.submit([&, b, numPartitions](){
+                dmmResults fitted = fitReweighted(data, block, multiplicity[b], numPartitions, options);
+                results.laplace[b][numPartitions-1] = fitted.laplace;
+                results.bic[b][numPartitions-1] = fitted.bic;
+            }, (double)numPartitions);
+        }
+    }
+    pool.wait();
+
+    delete sparse;
+    return results;
+}
+
+/**************************************************************************************************/
+
+//the samples are shuffled (seeded from the options seed) and dealt into numFolds folds. each fold is held
+//out in turn: the fit of every K sees the other folds through their weights, the held-out ones having
+//weight zero, and the held-out rows are then scored under the fitted mixture. every (fold, K) pair is its
+//own task, processors at a time; heldOut[f][K-1] is the held-out negative log-likelihood per sample
+
+vector<vector<double> > crossValidate(const CountDataset& data, int numFolds, int maxPartitions, const dmmOptions& options, int processors){
+
+    vector<vector<double> > heldOut(numFolds, vector<double>(maxPartitions, 0.0000));
+
+    SparseCountMatrix* sparse = (data.getCounts() != NULL) ? new SparseCountMatrix(*data.getCounts()) : NULL;
+    const countBlock* block = (sparse != NULL) ? &sparse->getBlock() : data.getBlock();
+    if(block == NULL){  processors = 1; }
+
+    int numSamples = data.getNumSamples();
+    vector<double> rowWeights;
+    getRowWeights(data, block, rowWeights);
+
+    vector<int> order(numSamples), foldOf(numSamples);
+    for(int i=0;i<numSamples;i++){  order[i] = i;   }
+    mt19937 randomGenerator(options.seed);
+    shuffle(order.begin(), order.end(), randomGenerator);
+    for(int i=0;i<numSamples;i++){  foldOf[order[i]] = i % numFolds;    }
+
+    vector<vector<double> > training(numFolds, rowWeights);
+    for(int i=0;i<numSamples;i++){  training[foldOf[i]][i] = 0.0000;    }
+
+    vector<string> otuNames = data.getOTUNames();
+
+    threadPool pool(processors);
+    for(int f=0;f<numFolds;f++){
+        for(int numPartitions=1;numPartitions<=maxPartitions;numPartitions++){
+            pool.submit([&, f, numPartitions](){
+                dmmResults fitted = fitReweighted(data, block, training[f], numPartitions, options);
+                dmmScorer scorer(fitted, otuNames, otuNames);
+
+                CountBlockView* view = (block != NULL) ? new CountBlockView(*block, data.getNumOTUs()) : NULL;
+                CountSource& rows = (view != NULL) ? *view : *data.getSource();
+
+                double logLikelihood = 0.0000;
+                double weight = 0.0000;
+                vector<double> posteriors;
+
+                rows.rewind();
+                while(const countBlock* b = rows.nextBlock()){
+                    for(int row=0;row<b->numSamples;row++){
+                        int sample = b->firstSample + row;
+                        if(foldOf[sample] != f){    continue;   }
+
+                        int start = b->rowStart[row];
+                        int numNonZero = b->rowStart[row+1] - start;
+                        logLikelihood += rowWeights[sample] * scorer.scoreSample(numNonZero ? &b->otus[start] : NULL, numNonZero ? &b->counts[start] : NULL, numNonZero, posteriors);
+                        weight += rowWeights[sample];
+                    }
+                }
+                delete view;
+
+                heldOut[f][numPartitions-1] = -logLikelihood / weight;
+            }, (double)numPartitions);
+        }
+    }
+    pool.wait();
+
+    delete sparse;
+    return heldOut;
+}
+
+/**************************************************************************************************/
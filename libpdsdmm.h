@@ -0,0 +1,149 @@
+//
+//  libpdsdmm.h
+//  pds_dmm
+//
+//  Copyright (c) 2012 University of Michigan. All rights reserved.
+//
+
+#ifndef pds_dmm_libpdsdmm_h
+#define pds_dmm_libpdsdmm_h
+
+/**************************************************************************************************/
+
+//entry points of libpdsdmm.a for programs that fit in-process; pds_dmm itself is a command line
+//wrapper around these. results come back as dmmResults (see dmmResults.h for the file writers)
+
+#include "qFinderDMM.h"
+#include "fitCache.h"
+
+/**************************************************************************************************/
+
+//count data handed to the library. a dataset only points at the caller's counts and names, which must
+//outlive it; nothing is copied. dense and in-memory sparse datasets can be fitted from several threads
+//at once, a dataset over a CountSource (e.g. an out-of-core file) only from one
+
+class CountDataset {
+
+public:
+    CountDataset(const vector<vector<int> >&, const vector<string>&, const vector<string>&);
+    CountDataset(const countBlock&, const vector<string>&, const vector<string>&);
+    CountDataset(CountSource&, const vector<string>&, const vector<string>&);
+
+    int getNumSamples() const                       {   return (int)sampleNames.size(); }
+    int getNumOTUs() const                          {   return (int)otuNames.size();    }
+    const vector<string>& getSampleNames() const    {   return sampleNames; }
+    const vector<string>& getOTUNames() const       {   return otuNames;    }
+
+    const vector<vector<int> >* getCounts() const   {   return counts;      }
+    const countBlock* getBlock() const              {   return block;       }
+    CountSource* getSource() const                  {   return source;      }
+
+private:
+    const vector<vector<int> >* counts;
+    const countBlock* block;
+    CountSource* source;
+
+    const vector<string>& sampleNames;
+    const vector<string>& otuNames;
+
+};
+
+/**************************************************************************************************/
+
+//a sweep fits K = 1, 2, ... up to maxPartitions and stops early once the best Laplace value is
+//optimizeGap K behind (and at least minPartitions were fit); an optimizeGap of -1 never stops early.
+//an adaptive sweep instead doubles K until the Laplace value rises, narrows that bracket by golden-section
+//steps and then fits every K within confirmWindow of the best, repeating around any new best; it ignores
+//minPartitions and optimizeGap. a cache, when given, is checked before and filled after every fit
+
+struct sweepOptions {
+
+    int minPartitions;
+    int maxPartitions;
+    int optimizeGap;
+    bool adaptive;
+    int confirmWindow;
+    fitCache* cache;
+
+    sweepOptions() : minPartitions(5), maxPartitions(100), optimizeGap(3), adaptive(false), confirmWindow(2), cache(NULL) {}
+
+};
+
+//called once per K, in the order they are fit, with the fit and whether it is the best so far; the
+//callback may take the results (e.g. by swapping them out), the sweep keeps its own copies of the
+//reference and best fits
+
+typedef function<void(dmmResults&, bool)> sweepCallback;
+
+/**************************************************************************************************/
+
+//how far a refit moved from the model it started at, per partition: the change in mixing weight, the
+//L1 distance between the old and new relative abundances (alpha / sum alpha) and the largest change in
+//any lambda
+
+struct refitMovement {
+
+    vector<double> piChange;
+    vector<double> abundanceDistance;
+    vector<double> maxLambdaChange;
+
+};
+
+/**************************************************************************************************/
+
+//how the otus of a table map onto a smaller set of bins: binOf holds the bin of every otu (-1 when it is
+//dropped) and share its fraction of the bin's total count, which is how a fit on the bins is spread back
+//over the otus
+
+struct otuMapping {
+
+    vector<int> binOf;
+    vector<double> share;
+    vector<string> binNames;
+
+};
+
+//thresholds below which an otu counts as rare: the (weighted) number of samples holding it, its total
+//count and its mean relative abundance across samples. otus without any counts are always rare
+
+struct otuFilter {
+
+    double minPrevalence;
+    double minCount;
+    double minRelAbund;
+    bool pool;
+
+    otuFilter() : minPrevalence(0), minCount(0), minRelAbund(0), pool(true) {}
+
+};
+
+/**************************************************************************************************/
+
+//the fit statistics of every bootstrap replicate for K = 1..maxPartitions: laplace[b][K-1], bic[b][K-1]
+
+struct bootstrapResults {
+
+    vector<vector<double> > laplace;
+    vector<vector<double> > bic;
+
+};
+
+/**************************************************************************************************/
+
+otuMapping getCoarseMapping(const CountDataset&, int);
+otuMapping getRareOTUMapping(const CountDataset&, const otuFilter&);
+SparseCountMatrix* aggregateOTUs(const CountDataset&, const otuMapping&);
+void expandOTUs(dmmResults&, const otuMapping&);
+
+dmmResults fit(const CountDataset&, int, const dmmOptions&);
+dmmResults refit(const CountDataset&, const dmmResults&, const vector<string>&, const dmmOptions&, refitMovement&);
+dmmResults fitDesign(const CountDataset&, const vector<vector<double> >&, const dmmOptions&);
+void sweep(const CountDataset&, const sweepOptions&, const dmmOptions&, sweepCallback, dmmResults&, dmmResults&);
+vector<double> permuteDesign(const CountDataset&, const vector<vector<double> >&, int, const dmmOptions&, int);
+vector<dmmResults> fitDesigns(const CountDataset&, const vector<vector<vector<double> > >&, const dmmOptions&, int);
+bootstrapResults bootstrapSweep(const CountDataset&, int, int, const dmmOptions&, int);
+vector<vector<double> > crossValidate(const CountDataset&, int, int, const dmmOptions&, int);
+
+/**************************************************************************************************/
+
+#endif
@@ -1541,7 +1541,7 @@ void LinearAlgebra::ludcmp(vector<vector<double> >& A, vector<int>& index, doubl
     for(int i=0;i<n;i++){
         double big = 0.0;
         for(int j=0;j<n;j++){   if((temp=fabs(A[i][j])) > big ) big=temp;  }
-        if(big==0.0){   cout << "Singular matrix in routine ludcmp" << endl;    }
+        if(big==0.0){   cerr << "Singular matrix in routine ludcmp" << endl;    }
         vv[i] = 1.0/big;
     }
     
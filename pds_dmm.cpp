@@ -9,19 +9,52 @@
 /**************************************************************************************************/
 
 #include "pds_dmm.h"
-#include "qFinderDMM.h"
+#include "libpdsdmm.h"
+#include "dmmResults.h"
+#include "resultWriter.h"
+#include "fitCache.h"
+#include "batchRunner.h"
+#include "dmmServer.h"
+#include "scoreRunner.h"
 
 /**************************************************************************************************/
 
+//the value below which the given fraction of values fall, to the nearest value
 
-int main(int argc, char *argv[]){
+static double getPercentile(vector<double> values, double fraction){
+
+    sort(values.begin(), values.end());
+    return values[(int)(fraction * (values.size() - 1) + 0.5)];
+}
+
+/**************************************************************************************************/
+
+static int runPdsDmm(int argc, char *argv[]){
     
-    srand( (unsigned)time( NULL ) );
+    dmmOptions options;
+    options.seed = (unsigned)time( NULL );
     
     cout.setf(ios::fixed, ios::floatfield);
     cout.setf(ios::showpoint);
     
     string sharedFileName, designFileName;
+    string outputFormat = "text";
+    string cacheDirectory;
+    string batchFileName;
+    string socketPath;
+    string modelFileName;
+    string warmStartFileName;
+    int processors = max((int)thread::hardware_concurrency(), 1);
+    double memoryBudget = 0;
+    string tmpDirectory = (getenv("TMPDIR") != NULL) ? getenv("TMPDIR") : "/tmp";
+    bool collapse = false;
+    bool saveModel = false;
+    bool seedGiven = false;
+    int numPermutations = 0;
+    int numReplicates = 0;
+    int numFolds = 0;
+    otuFilter filter;
+    bool filterOTUs = false;
     vector<vector<int> > sharedMatrix;
     vector<string> otuNames;
     vector<string> sampleNames;
@@ -29,6 +62,10 @@ int main(int argc, char *argv[]){
     int minNumPartitions = 5;
     int maxNumPartitions = 100;
     int optimizeGap = 3;
+    bool adaptiveSearch = false;
+    int confirmWindow = 2;
+    int topK = 0;
+    double minPosterior = 0.0001;
     
     if(argc > 1) {
         for(char **p=argv+1;p<argv+argc;p++) {
@@ -60,82 +97,678 @@ int main(int argc, char *argv[]){
                 istringstream f(*p);
                 if(!(f >> optimizeGap)){}
             }
+            else if(strcmp(*p,"-topk")==0) {
+                if(++p>=argv+argc){}
+                istringstream f(*p);
+                if(!(f >> topK)){}
+            }
+            else if(strcmp(*p,"-minposterior")==0) {
+                if(++p>=argv+argc){}
+                istringstream f(*p);
+                if(!(f >> minPosterior)){}
+            }
+            else if(strcmp(*p,"-seed")==0) {
+                if(++p>=argv+argc){}
+                istringstream f(*p);
+                if(!(f >> options.seed)){}
+                seedGiven = true;
+            }
+            else if(strcmp(*p,"-cache")==0) {
+                if(++p>=argv+argc){}
+                istringstream f(*p);
+                if(!(f >> cacheDirectory)){}
+            }
+            else if(strcmp(*p,"-memory")==0) {
+                if(++p>=argv+argc){}
+                istringstream f(*p);
+                if(!(f >> memoryBudget)){}
+            }
+            else if(strcmp(*p,"-tmpdir")==0) {
+                if(++p>=argv+argc){}
+                istringstream f(*p);
+                if(!(f >> tmpDirectory)){}
+            }
+            else if(strcmp(*p,"-output")==0) {
+                if(++p>=argv+argc){}
+                istringstream f(*p);
+                if(!(f >> outputFormat)){}
+                if(outputFormat != "text" && outputFormat != "binary" && outputFormat != "both" && outputFormat != "stream") {
+                    cerr << "Error: -output must be text, binary, both or stream." << endl;
+                    exit(1);
+                }
+            }
+            else if(strcmp(*p,"-batch")==0) {
+                if(++p>=argv+argc){}
+                istringstream f(*p);
+                if(!(f >> batchFileName)){}
+            }
+            else if(strcmp(*p,"-server")==0) {
+                if(++p>=argv+argc){}
+                istringstream f(*p);
+                if(!(f >> socketPath)){}
+            }
+            else if(strcmp(*p,"-score")==0) {
+                if(++p>=argv+argc){}
+                istringstream f(*p);
+                if(!(f >> modelFileName)){}
+            }
+            else if(strcmp(*p,"-warmstart")==0) {
+                if(++p>=argv+argc){}
+                istringstream f(*p);
+                if(!(f >> warmStartFileName)){}
+            }
+            else if(strcmp(*p,"-maxiterations")==0) {
+                if(++p>=argv+argc){}
+                istringstream f(*p);
+                if(!(f >> options.maxIterations)){}
+            }
+            else if(strcmp(*p,"-batchsize")==0) {
+                if(++p>=argv+argc){}
+                istringstream f(*p);
+                if(!(f >> options.batchSize)){}
+            }
+            else if(strcmp(*p,"-stochasticpasses")==0) {
+                if(++p>=argv+argc){}
+                istringstream f(*p);
+                if(!(f >> options.stochasticPasses)){}
+            }
+            else if(strcmp(*p,"-finalpasses")==0) {
+                if(++p>=argv+argc){}
+                istringstream f(*p);
+                if(!(f >> options.finalPasses)){}
+            }
+            else if(strcmp(*p,"-coreset")==0) {
+                if(++p>=argv+argc){}
+                istringstream f(*p);
+                if(!(f >> options.coresetSize)){}
+            }
+            else if(strcmp(*p,"-refineiterations")==0) {
+                if(++p>=argv+argc){}
+                istringstream f(*p);
+                if(!(f >> options.refineIterations)){}
+            }
+            else if(strcmp(*p,"-coarseotus")==0) {
+                if(++p>=argv+argc){}
+                istringstream f(*p);
+                if(!(f >> options.coarseOTUs)){}
+            }
+            else if(strcmp(*p,"-minprevalence")==0) {
+                if(++p>=argv+argc){}
+                istringstream f(*p);
+                if(!(f >> filter.minPrevalence)){}
+                filterOTUs = true;
+            }
+            else if(strcmp(*p,"-mincount")==0) {
+                if(++p>=argv+argc){}
+                istringstream f(*p);
+                if(!(f >> filter.minCount)){}
+                filterOTUs = true;
+            }
+            else if(strcmp(*p,"-minrelabund")==0) {
+                if(++p>=argv+argc){}
+                istringstream f(*p);
+                if(!(f >> filter.minRelAbund)){}
+                filterOTUs = true;
+            }
+            else if(strcmp(*p,"-rareotus")==0) {
+                if(++p>=argv+argc){}
+                string rareOTUs;
+                istringstream f(*p);
+                if(!(f >> rareOTUs)){}
+                if(rareOTUs != "pool" && rareOTUs != "drop"){
+                    cerr << "Error: -rareotus must be pool or drop." << endl;
+                    exit(1);
+                }
+                filter.pool = (rareOTUs == "pool");
+            }
+            else if(strcmp(*p,"-zthreshold")==0) {
+                if(++p>=argv+argc){}
+                istringstream f(*p);
+                if(!(f >> options.activeThreshold)){}
+            }
+            else if(strcmp(*p,"-classification")==0) {
+                options.classificationEM = true;
+            }
+            else if(strcmp(*p,"-permutations")==0) {
+                if(++p>=argv+argc){}
+                istringstream f(*p);
+                if(!(f >> numPermutations)){}
+            }
+            else if(strcmp(*p,"-bootstrap")==0) {
+                if(++p>=argv+argc){}
+                istringstream f(*p);
+                if(!(f >> numReplicates)){}
+            }
+            else if(strcmp(*p,"-cvfolds")==0) {
+                if(++p>=argv+argc){}
+                istringstream f(*p);
+                if(!(f >> numFolds)){}
+            }
+            else if(strcmp(*p,"-search")==0) {
+                if(++p>=argv+argc){}
+                string search;
+                istringstream f(*p);
+                if(!(f >> search)){}
+                if(search != "linear" && search != "adaptive"){
+                    cerr << "Error: -search must be linear or adaptive." << endl;
+                    exit(1);
+                }
+                adaptiveSearch = (search == "adaptive");
+            }
+            else if(strcmp(*p,"-confirmwindow")==0) {
+                if(++p>=argv+argc){}
+                istringstream f(*p);
+                if(!(f >> confirmWindow)){}
+            }
+            else if(strcmp(*p,"-collapse")==0) {
+                collapse = true;
+            }
+            else if(strcmp(*p,"-savemodel")==0) {
+                saveModel = true;
+            }
+            else if(strcmp(*p,"-processors")==0) {
+                if(++p>=argv+argc){}
+                istringstream f(*p);
+                if(!(f >> processors)){}
+            }
             else{   
-                cout << "you entered the wrong parameter" << endl;
+                cerr << "you entered the wrong parameter" << endl;
             }
         }
     }
     
 
-    double minLaplace = 1e10;
-    int minPartition = 0;
+    //cache entries are keyed on the seed, so the default seed taken from the clock would never hit
+    if(cacheDirectory != "" && !seedGiven){
+        cerr << "Error: -cache needs -seed; cached fits are only reused by runs with the same seed." << endl;
+        exit(1);
+    }
+
+    outputSettings settings;
+    settings.writeText = (outputFormat == "text" || outputFormat == "both");
+    settings.writeBinary = (outputFormat == "binary" || outputFormat == "both");
+    settings.writeStream = (outputFormat == "stream");
+    settings.topK = topK;
+    settings.minPosterior = minPosterior;
+    settings.saveModel = saveModel;
     
-    readSharedFile(sharedFileName, sharedMatrix, otuNames, sampleNames);
+    //a batch runs every job in the manifest on one pool of worker threads
+    if(batchFileName != ""){
+        if(settings.writeStream || memoryBudget > 0){
+            cerr << "Error: -batch cannot be combined with -output stream or -memory." << endl;
+            exit(1);
+        }
+        if(collapse || filterOTUs){
+            throw inputError("-batch cannot be combined with -collapse, -minprevalence, -mincount, -minrelabund or -rareotus");
+        }
+
+        batchSettings batch;
+        batch.options = options;
+        batch.output = settings;
+        batch.cacheDirectory = cacheDirectory;
+        batch.minPartitions = minNumPartitions;
+        batch.maxPartitions = maxNumPartitions;
+        batch.optimizeGap = optimizeGap;
+        batch.adaptive = adaptiveSearch;
+        batch.confirmWindow = confirmWindow;
+        batch.processors = processors;
+
+        runBatch(batchFileName, batch);
+        return 0;
+    }
+
+    //a server keeps datasets and fits in memory and answers requests on a Unix socket until shut down
+    if(socketPath != ""){
+        if(settings.writeStream){
+            cerr << "Error: -server cannot be combined with -output stream." << endl;
+            exit(1);
+        }
+
+        dmmServer server(socketPath, options, settings);
+        server.run();
+        return 0;
+    }
 
+    //scoring assigns the samples in the shared file to the partitions of a saved model (Kmix.model or
+    //Kmix.bin) without fitting
+    if(modelFileName != ""){
+        scoreSettings scoring;
+        scoring.output = settings;
+        scoring.processors = processors;
+        scoring.blockSize = 10000;
+
+        string outputRoot = (sharedFileName == "-") ? "stdin." : sharedFileName.substr(0,sharedFileName.find_last_of(".")+1);
+        runScoring(modelFileName, sharedFileName, outputRoot, scoring);
+        return 0;
+    }
+
+    //when stdout carries the result stream the progress table moves to stderr
+    ostream& console = settings.writeStream ? cerr : cout;
+    console.setf(ios::fixed, ios::floatfield);
+    console.setf(ios::showpoint);
+
+    //a shared file of "-" is read from stdin and its outputs are named stdin.*
+    string sharedRoot = (sharedFileName == "-") ? "stdin." : sharedFileName.substr(0,sharedFileName.find_last_of(".")+1);
+
+    CountSource* source = readCountFile(sharedFileName, tmpDirectory, memoryBudget * 1024.0 * 1024.0, sharedMatrix, otuNames, sampleNames);
+
+    //rare otus are dropped or pooled before fitting; the fits are spread back over the original otus before
+    //anything is written, so the relative abundances and the summary still name every otu
+    otuMapping mapping;
+
+    if(filterOTUs){
+        CountDataset raw = (source != NULL) ? CountDataset(*source, sampleNames, otuNames) : CountDataset(sharedMatrix, sampleNames, otuNames);
+        mapping = getRareOTUMapping(raw, filter);
+
+        SparseCountMatrix* filtered = aggregateOTUs(raw, mapping);
+        delete source;
+        sharedMatrix.clear();
+        source = filtered;
+
+        console << "Fitting " << mapping.binNames.size() << " of " << otuNames.size() << " OTUs";
+        if(filter.pool){    console << " (rare OTUs pooled into Other)";    }
+        console << endl << endl;
+    }
+
+    const vector<string>& fitOTUNames = filterOTUs ? mapping.binNames : otuNames;
+
+    //with -collapse identical count rows are fitted once as a weighted row, named after their first sample;
+    //the posteriors are expanded back to every sample before anything is written
+    vector<int> rowOf, firstRow;
+    vector<string> collapsedNames;
+
+    if(collapse){
+        if(designFileName != ""){
+            cerr << "Error: -collapse cannot be combined with -design." << endl;
+            exit(1);
+        }
+
+        SparseCountMatrix* rows = (source == NULL) ? new SparseCountMatrix(sharedMatrix) : NULL;
+        SparseCountMatrix* collapsed = collapseRows((source != NULL) ? *source : *rows, rowOf, firstRow);
+        delete rows;
+        delete source;
+        sharedMatrix.clear();
+        source = collapsed;
+
+        for(int i=0;i<firstRow.size();i++){ collapsedNames.push_back(sampleNames[firstRow[i]]);  }
+        console << "Collapsed " << sampleNames.size() << " samples into " << collapsedNames.size() << " distinct rows" << endl << endl;
+    }
+
+    const vector<string>& fitNames = collapse ? collapsedNames : sampleNames;
+
+    //a warm start refits the K of a previous model (Kmix.model or Kmix.bin) on the current data, which
+    //usually holds the old samples plus new ones, and reports how far each partition moved. the refit is
+    //written to <root>warm.Kmix.* so the model it started from is never overwritten
+    if(warmStartFileName != ""){
+        dmmResults previous;
+        vector<string> previousSamples, previousOTUs;
+        if(!readBinaryResults(warmStartFileName, previous, previousSamples, previousOTUs)){
+            cerr << "Error: could not read the model in " << warmStartFileName << endl;
+            exit(1);
+        }
+
+        CountDataset data = (source != NULL) ? CountDataset(*source, fitNames, fitOTUNames) : CountDataset(sharedMatrix, fitNames, fitOTUNames);
+        refitMovement movement;
+        dmmResults results = refit(data, previous, previousOTUs, options, movement);
+        if(collapse){   expandSamples(results, rowOf);  }
+        if(filterOTUs){ expandOTUs(results, mapping);   }
+
+        console << "K\tNLE\t\tlogDet\tBIC\t\tAIC\t\tLaplace" << endl;
+        console << results.numPartitions << '\t';
+        console << setprecision (2) << results.nll << '\t' << results.logDeterminant << '\t';
+        console << results.bic << '\t' << results.aic << '\t' << results.laplace << endl << endl;
+
+        console << "Partition\tPiChange\tAbundanceL1\tMaxLambdaChange" << endl;
+        for(int i=0;i<results.numPartitions;i++){
+            console << "Partition_" << i+1 << '\t' << setprecision(4) << movement.piChange[i] << '\t';
+            console << movement.abundanceDistance[i] << '\t' << movement.maxLambdaChange[i] << endl;
+        }
+
+        writeResults(sharedRoot+"warm."+toString(results.numPartitions), results, sampleNames, otuNames, settings);
+        delete source;
+        return 0;
+    }
+
+    //the bootstrap refits K = 1 up to the K where the sweep of the full table stops on tables resampled by
+    //sample and reports how often each K has the lowest Laplace value, with 95% intervals of its Laplace and
+    //BIC values
+    if(numReplicates > 0){
+        if(designFileName != ""){
+            cerr << "Error: -bootstrap cannot be combined with -design." << endl;
+            exit(1);
+        }
+
+        SparseCountMatrix* sparse = dynamic_cast<SparseCountMatrix*>(source);
+        CountDataset data = (sparse != NULL) ? CountDataset(sparse->getBlock(), fitNames, fitOTUNames) :
+                            (source != NULL) ? CountDataset(*source, fitNames, fitOTUNames) : CountDataset(sharedMatrix, fitNames, fitOTUNames);
+
+        //the sweep honors -minpartitions, -optimize and -search, and K is never above the number of samples
+        sweepOptions sweepSettings;
+        sweepSettings.minPartitions = minNumPartitions;
+        sweepSettings.maxPartitions = min(maxNumPartitions, (int)fitNames.size());
+        sweepSettings.optimizeGap = optimizeGap;
+        sweepSettings.adaptive = adaptiveSearch;
+        sweepSettings.confirmWindow = confirmWindow;
+
+        int numPartitions = 0;
+        dmmResults reference, best;
+        sweep(data, sweepSettings, options, [&](dmmResults& results, bool isBest){
+            numPartitions = max(numPartitions, results.numPartitions);
+        }, reference, best);
+
+        bootstrapResults replicates = bootstrapSweep(data, numReplicates, numPartitions, options, processors);
+
+        vector<int> timesSelected(numPartitions, 0);
+        for(int b=0;b<numReplicates;b++){
+            vector<double>& laplace = replicates.laplace[b];
+            timesSelected[min_element(laplace.begin(), laplace.end()) - laplace.begin()]++;
+        }
+
+        stringstream bootstrapData;
+        bootstrapData.setf(ios::fixed, ios::floatfield);
+        bootstrapData.setf(ios::showpoint);
+        bootstrapData << "K\tSelected\tLaplaceLow\tLaplaceHigh\tBICLow\tBICHigh" << endl;
+
+        for(int k=0;k<numPartitions;k++){
+            vector<double> laplace(numReplicates), bic(numReplicates);
+            for(int b=0;b<numReplicates;b++){
+                laplace[b] = replicates.laplace[b][k];
+                bic[b] = replicates.bic[b][k];
+            }
+
+            bootstrapData << k+1 << '\t' << setprecision(4) << timesSelected[k] / (double)numReplicates << '\t' << setprecision(2);
+            bootstrapData << getPercentile(laplace, 0.025) << '\t' << getPercentile(laplace, 0.975) << '\t';
+            bootstrapData << getPercentile(bic, 0.025) << '\t' << getPercentile(bic, 0.975) << endl;
+        }
+
+        console << bootstrapData.str();
+        if(settings.writeStream){
+            cout << streamSectionMarker << sharedRoot << "mix.bootstrap" << endl << bootstrapData.str();
+        }
+        else{
+            ofstream bootstrapFile((sharedRoot+"mix.bootstrap").c_str());
+            bootstrapFile << bootstrapData.str();
+            bootstrapFile.close();
+        }
+        delete source;
+        return 0;
+    }
+
+    //cross-validation fits K = 1..maxpartitions with each fold held out in turn and reports the held-out
+    //negative log-likelihood per sample, averaged over the folds, with its standard deviation
+    if(numFolds > 0){
+        if(designFileName != ""){
+            cerr << "Error: -cvfolds cannot be combined with -design." << endl;
+            exit(1);
+        }
+        if(numFolds < 2 || numFolds > fitNames.size()){
+            cerr << "Error: -cvfolds needs between 2 and " << fitNames.size() << " folds." << endl;
+            exit(1);
+        }
+
+        SparseCountMatrix* sparse = dynamic_cast<SparseCountMatrix*>(source);
+        CountDataset data = (sparse != NULL) ? CountDataset(sparse->getBlock(), fitNames, fitOTUNames) :
+                            (source != NULL) ? CountDataset(*source, fitNames, fitOTUNames) : CountDataset(sharedMatrix, fitNames, fitOTUNames);
+        vector<vector<double> > heldOut = crossValidate(data, numFolds, maxNumPartitions, options, processors);
+
+        vector<double> meanNLL(maxNumPartitions, 0.0000), sdNLL(maxNumPartitions, 0.0000);
+        for(int k=0;k<maxNumPartitions;k++){
+            for(int f=0;f<numFolds;f++){    meanNLL[k] += heldOut[f][k] / numFolds; }
+            for(int f=0;f<numFolds;f++){    sdNLL[k] += (heldOut[f][k] - meanNLL[k]) * (heldOut[f][k] - meanNLL[k]) / (numFolds - 1);   }
+            sdNLL[k] = sqrt(sdNLL[k]);
+        }
+        int bestK = (int)(min_element(meanNLL.begin(), meanNLL.end()) - meanNLL.begin());
+
+        stringstream cvData;
+        cvData.setf(ios::fixed, ios::floatfield);
+        cvData.setf(ios::showpoint);
+        cvData << "K\tHeldOutNLL\tSD";
+        for(int f=0;f<numFolds;f++){    cvData << "\tFold_" << f+1;    }
+        cvData << endl;
+
+        console << "K\tHeldOutNLL\tSD" << endl;
+        for(int k=0;k<maxNumPartitions;k++){
+            console << k+1 << '\t' << setprecision(4) << meanNLL[k] << '\t' << sdNLL[k];
+            if(k == bestK){ console << "***";   }
+            console << endl;
+
+            cvData << k+1 << '\t' << setprecision(4) << meanNLL[k] << '\t' << sdNLL[k];
+            for(int f=0;f<numFolds;f++){    cvData << '\t' << heldOut[f][k];   }
+            cvData << endl;
+        }
+
+        if(settings.writeStream){
+            cout << streamSectionMarker << sharedRoot << "mix.cv" << endl << cvData.str();
+        }
+        else{
+            ofstream cvFile((sharedRoot+"mix.cv").c_str());
+            cvFile << cvData.str();
+            cvFile.close();
+        }
+        delete source;
+        return 0;
+    }
 
     if(designFileName==""){
-        string fileRoot = sharedFileName.substr(0,sharedFileName.find_last_of(".")+1);
-        ofstream fitData((fileRoot+"mix.fit").c_str());
+        string fileRoot = sharedRoot;
+        stringstream fitData;
         fitData.setf(ios::fixed, ios::floatfield);
         fitData.setf(ios::showpoint);
      
-        cout << "K\tNLE\t\tlogDet\tBIC\t\tAIC\t\tLaplace" << endl;
+        console << "K\tNLE\t\tlogDet\tBIC\t\tAIC\t\tLaplace" << endl;
         fitData << "K\tNLE\tlogDet\tBIC\tAIC\tLaplace" << endl;
 
-        for(int numPartitions=1;numPartitions<=maxNumPartitions;numPartitions++){
-            qFinderDMM findQ(sharedMatrix, numPartitions);
+        dmmResults reference, best;
+        resultWriter writer(sampleNames, otuNames, settings, 2);
+        
+        sweepOptions sweepSettings;
+        sweepSettings.minPartitions = minNumPartitions;
+        sweepSettings.maxPartitions = maxNumPartitions;
+        sweepSettings.optimizeGap = optimizeGap;
+        sweepSettings.adaptive = adaptiveSearch;
+        sweepSettings.confirmWindow = confirmWindow;
+        vector<int> evaluated;
+        
+        if(cacheDirectory != "" && source != NULL)  {   sweepSettings.cache = new fitCache(cacheDirectory, *source);      }
+        else if(cacheDirectory != "")               {   sweepSettings.cache = new fitCache(cacheDirectory, sharedMatrix); }
+        
+        CountDataset data = (source != NULL) ? CountDataset(*source, fitNames, fitOTUNames) : CountDataset(sharedMatrix, fitNames, fitOTUNames);
+        
+        //an adaptive search fits K out of order, so its rows are held back and listed by K once the best is known
+        map<int, string> fitRows;
+        
+        sweep(data, sweepSettings, options, [&](dmmResults& results, bool isBest){
+            evaluated.push_back(results.numPartitions);
+            if(collapse){   expandSamples(results, rowOf);  }
+            if(filterOTUs){ expandOTUs(results, mapping);   }
             
-            double laplace = findQ.getLaplace();
-            cout << numPartitions << '\t';
-            cout << setprecision (2) << findQ.getNLL() << '\t' << findQ.getLogDet() << '\t';
-            cout << findQ.getBIC() << '\t' << findQ.getAIC() << '\t' << laplace;
+            stringstream row;
+            row.setf(ios::fixed, ios::floatfield);
+            row.setf(ios::showpoint);
+            row << results.numPartitions << '\t';
+            row << setprecision (2) << results.nll << '\t' << results.logDeterminant << '\t';
+            row << results.bic << '\t' << results.aic << '\t' << results.laplace;
             
-            fitData << numPartitions << '\t';
-            fitData << setprecision (2) << findQ.getNLL() << '\t' << findQ.getLogDet() << '\t';
-            fitData << findQ.getBIC() << '\t' << findQ.getAIC() << '\t' << laplace << endl;
+            if(adaptiveSearch){
+                fitRows[results.numPartitions] = row.str();
+            }
+            else{
+                console << row.str();
+                if(isBest){ console << "***";   }
+                console << endl;
+                fitData << row.str() << endl;
+            }
+            
+            writer.write(fileRoot+toString(results.numPartitions), results);
+        }, reference, best);
+        
+        writer.finish();
+        delete sweepSettings.cache;
 
-            if(laplace < minLaplace){
-                minPartition = numPartitions;
-                minLaplace = laplace;
-                cout << "***";
+        if(adaptiveSearch){
+            for(map<int, string>::iterator it=fitRows.begin();it!=fitRows.end();it++){
+                console << it->second;
+                if(it->first == best.numPartitions){    console << "***";   }
+                console << endl;
+                fitData << it->second << endl;
             }
-            cout << endl;
             
-            findQ.printZMatrix(fileRoot+toString(numPartitions)+"mix.posterior", sampleNames);
-            findQ.printRelAbund(fileRoot+toString(numPartitions)+"mix.relabund", otuNames);
+            console << endl << "Evaluated " << evaluated.size() << " K:";
+            for(int i=0;i<evaluated.size();i++){    console << ' ' << evaluated[i]; }
+            console << endl << "Best K: " << best.numPartitions << endl;
+        }
 
-            if(optimizeGap != -1 && (numPartitions - minPartition) >= optimizeGap && numPartitions >= minNumPartitions){ break;  }
+        if(collapse){
+            expandSamples(reference, rowOf);
+            expandSamples(best, rowOf);
+        }
+        if(filterOTUs){
+            expandOTUs(reference, mapping);
+            expandOTUs(best, mapping);
         }
-        fitData.close();
 
-        generateSummaryFile(minPartition, fileRoot);
+        if(settings.writeStream){
+            cout << streamSectionMarker << fileRoot << "mix.fit" << endl << fitData.str();
+            streamSummary(reference, best, otuNames, sampleNames, fileRoot);
+        }
+        else{
+            ofstream fitFile((fileRoot+"mix.fit").c_str());
+            fitFile << fitData.str();
+            fitFile.close();
+
+            generateSummaryFile(reference, best, otuNames, sampleNames, fileRoot);
+        }
     }
     else{
         string fileRoot = designFileName.substr(0,designFileName.find_last_of(".")+1);
-        vector<vector<double> > partitions;
+        vector<string> designColumns;
+        vector<vector<vector<double> > > designs;
+
+        readDesignTable(designFileName, sampleNames, designColumns, designs);
+        
+        //in-memory sparse tables are fitted through their block so that concurrent fits can share them
+        SparseCountMatrix* sparse = dynamic_cast<SparseCountMatrix*>(source);
+        CountDataset data = (sparse != NULL) ? CountDataset(sparse->getBlock(), sampleNames, fitOTUNames) :
+                            (source != NULL) ? CountDataset(*source, sampleNames, fitOTUNames) : CountDataset(sharedMatrix, sampleNames, fitOTUNames);
+        
+        //every column of a multi-column design is a grouping of its own; they are fitted concurrently and
+        //reported in one table
+        if(designs.size() > 1){
+            if(numPermutations > 0){
+                cerr << "Error: -permutations needs a design with a single column." << endl;
+                exit(1);
+            }
+            
+            vector<dmmResults> results = fitDesigns(data, designs, options, processors);
+            
+            stringstream fitData;
+            fitData.setf(ios::fixed, ios::floatfield);
+            fitData.setf(ios::showpoint);
+            
+            console << "Design\tK\tNLE\t\tlogDet\tBIC\t\tAIC\t\tLaplace" << endl;
+            fitData << "Design\tK\tNLE\tlogDet\tBIC\tAIC\tLaplace" << endl;
+            
+            for(int c=0;c<results.size();c++){
+                console << designColumns[c] << '\t' << results[c].numPartitions << '\t';
+                console << setprecision (2) << results[c].nll << '\t' << results[c].logDeterminant << '\t';
+                console << results[c].bic << '\t' << results[c].aic << '\t' << results[c].laplace << endl;
+                
+                fitData << designColumns[c] << '\t' << results[c].numPartitions << '\t';
+                fitData << setprecision (2) << results[c].nll << '\t' << results[c].logDeterminant << '\t';
+                fitData << results[c].bic << '\t' << results[c].aic << '\t' << results[c].laplace << endl;
+            }
+            
+            if(settings.writeStream){
+                cout << streamSectionMarker << fileRoot << "fit" << endl << fitData.str();
+            }
+            else{
+                ofstream fitFile((fileRoot+"fit").c_str());
+                fitFile << fitData.str();
+                fitFile.close();
+            }
+        }
+        else{
+            vector<vector<double> >& partitions = designs[0];
+            
+            dmmResults results = fitDesign(data, partitions, options);
+        
+            double laplace = results.laplace;
 
-        readDesignFile(designFileName, sampleNames, partitions);
-        qFinderDMM findQ(sharedMatrix, partitions);
+            stringstream fitData;
+            fitData.setf(ios::fixed, ios::floatfield);
+            fitData.setf(ios::showpoint);
         
-        double laplace = findQ.getLaplace();
+            console << "K\tNLE\t\tlogDet\tBIC\t\tAIC\t\tLaplace" << endl;
+            fitData << "K\tNLE\tlogDet\tBIC\tAIC\tLaplace" << endl;
 
-        ofstream fitData((fileRoot+"fit").c_str());
-        fitData.setf(ios::fixed, ios::floatfield);
-        fitData.setf(ios::showpoint);
+            console << partitions.size() << '\t';
+            console << setprecision (2) << results.nll << '\t' << results.logDeterminant << '\t';
+            console << results.bic << '\t' << results.aic << '\t' << laplace << endl;
         
-        cout << "K\tNLE\t\tlogDet\tBIC\t\tAIC\t\tLaplace" << endl;
-        fitData << "K\tNLE\tlogDet\tBIC\tAIC\tLaplace" << endl;
+            fitData << partitions.size() << '\t';
+            fitData << setprecision (2) << results.nll << '\t' << results.logDeterminant << '\t';
+            fitData << results.bic << '\t' << results.aic << '\t' << laplace << endl;
 
-        cout << partitions.size() << '\t';
-        cout << setprecision (2) << findQ.getNLL() << '\t' << findQ.getLogDet() << '\t';
-        cout << findQ.getBIC() << '\t' << findQ.getAIC() << '\t' << laplace << endl;
+            if(settings.writeStream){
+                cout << streamSectionMarker << fileRoot << "fit" << endl << fitData.str();
+            }
+            else{
+                ofstream fitFile((fileRoot+"fit").c_str());
+                fitFile << fitData.str();
+                fitFile.close();
+            }
         
-        fitData << partitions.size() << '\t';
-        fitData << setprecision (2) << findQ.getNLL() << '\t' << findQ.getLogDet() << '\t';
-        fitData << findQ.getBIC() << '\t' << findQ.getAIC() << '\t' << laplace << endl;
-        fitData.close();
+            //the permutation test relabels the samples at random and asks how often chance does as well as the
+            //design; the p-value counts the observed design as one of the relabelings
+            if(numPermutations > 0){
+                vector<double> permuted = permuteDesign(data, partitions, numPermutations, options, processors);
+            
+                stringstream permutationData;
+                permutationData.setf(ios::fixed, ios::floatfield);
+                permutationData.setf(ios::showpoint);
+                permutationData << "Permutation\tLaplace\tDifference" << endl;
+            
+                int atLeastAsGood = 0;
+                double meanLaplace = 0.0000;
+                for(int p=0;p<numPermutations;p++){
+                    if(permuted[p] <= laplace){ atLeastAsGood++;    }
+                    meanLaplace += permuted[p] / numPermutations;
+                    permutationData << p+1 << '\t' << setprecision(2) << permuted[p] << '\t' << permuted[p] - laplace << endl;
+                }
+                double pValue = (atLeastAsGood + 1.0) / (numPermutations + 1.0);
+            
+                console << endl << "Permutations\tMeanLaplace\tDifference\tP" << endl;
+                console << numPermutations << '\t' << setprecision(2) << meanLaplace << '\t' << meanLaplace - laplace << '\t' << setprecision(4) << pValue << endl;
+            
+                if(settings.writeStream){
+                    cout << streamSectionMarker << fileRoot << "permutations" << endl << permutationData.str();
+                }
+                else{
+                    ofstream permutationFile((fileRoot+"permutations").c_str());
+                    permutationFile << permutationData.str();
+                    permutationFile.close();
+                }
+            }
+        }
     }
     
+    delete source;
+    return 0;
+}
+
+/**************************************************************************************************/
+
+//the readers throw on input they cannot use (see inputError); from the command line that ends the run
+
+int main(int argc, char *argv[]){
+    
+    try{
+        return runPdsDmm(argc, argv);
+    }
+    catch(inputError& e){
+        cerr << "Error: " << e.what() << endl;
+        exit(1);
+    }
 }
 
 /**************************************************************************************************/
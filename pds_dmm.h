@@ -23,12 +23,24 @@
 #include <map>
 #include <algorithm>
 #include <limits>
+#include <stdexcept>
 #include <string.h>
 
 using namespace std;
 
 /**************************************************************************************************/
 
+//thrown by the file readers on input they cannot use. the message is the text after "Error: "; the command
+//line reports it and exits, the server turns it into an error reply and keeps running
+
+struct inputError : public runtime_error {
+
+    inputError(string message) : runtime_error(message) {}
+
+};
+
+/**************************************************************************************************/
+
 template<typename T>
 string toString(const T&x){
 	
@@ -50,7 +62,7 @@ inline void gobble(istream& f){
 
 /**************************************************************************************************/
 
-inline string getline(ifstream& fileHandle) {
+inline string getline(istream& fileHandle) {
     string line = "";
     
     while (fileHandle)	{
@@ -75,9 +87,7 @@ inline double max(double a, double b){
 
 /**************************************************************************************************/
 
-inline void readSharedFile(string sharedFileName, vector<vector<int> >& sharedVector, vector<string>& otuNames, vector<string>& sampleNames){
-    
-    ifstream sharedFile(sharedFileName.c_str());
+inline void readSharedFile(istream& sharedFile, vector<vector<int> >& sharedVector, vector<string>& otuNames, vector<string>& sampleNames){
     
     string header = getline(sharedFile);
     string colHead;
@@ -97,14 +107,17 @@ inline void readSharedFile(string sharedFileName, vector<vector<int> >& sharedVe
     string sample;
     int numOTUs;
     
-    
+    gobble(sharedFile);
     while(sharedFile){
         
-        sharedFile >> label >> sample >> numOTUs;
+        if(!(sharedFile >> label >> sample >> numOTUs)){    throw inputError("shared file ends in the middle of a row");  }
+        if(numOTUs != (int)otuNames.size()){
+            throw inputError("sample " + sample + " has " + toString(numOTUs) + " OTUs but the header lists " + toString(otuNames.size()));
+        }
         
         vector<int> counts(numOTUs, 0);
         for(int i=0;i<numOTUs;i++){
-            sharedFile >> counts[i];
+            if(!(sharedFile >> counts[i])){ throw inputError("sample " + sample + " has fewer counts than OTUs");   }
         }
         
         sharedVector.push_back(counts);
@@ -112,7 +125,25 @@ inline void readSharedFile(string sharedFileName, vector<vector<int> >& sharedVe
         
         gobble(sharedFile);
     }
+    
+    if(otuNames.empty() || sampleNames.empty()){    throw inputError("shared file has no OTUs or no samples"); }
+
+}
+
+/**************************************************************************************************/
+
+//a file name of "-" reads the shared file from stdin
+
+inline void readSharedFile(string sharedFileName, vector<vector<int> >& sharedVector, vector<string>& otuNames, vector<string>& sampleNames){
+
+    if(sharedFileName == "-"){
+        readSharedFile(cin, sharedVector, otuNames, sampleNames);
+        return;
+    }
 
+    ifstream sharedFile(sharedFileName.c_str());
+    if(!sharedFile){    throw inputError("could not open " + sharedFileName);   }
+    readSharedFile(sharedFile, sharedVector, otuNames, sampleNames);
 }
 
 /**************************************************************************************************/
@@ -127,6 +158,8 @@ inline void readDesignFile(string designFileName, vector<string> sampleNames, ve
     string sample, partition;
     
     ifstream designFile(designFileName.c_str());
+    if(!designFile){    throw inputError("could not open " + designFileName);  }
+    
     for(int i=0;i<numSamples;i++){
                                   
         designFile >> sample >> partition;
@@ -152,52 +185,71 @@ inline void readDesignFile(string designFileName, vector<string> sampleNames, ve
 
 /**************************************************************************************************/
 
-inline vector<double> generateDesignFile(int numPartitions, string fileRoot){
-
-    vector<double> piValues(numPartitions, 0);
-    
-    ifstream postFile((fileRoot + toString(numPartitions) + "mix.posterior").c_str());
-    ofstream designFile((fileRoot + "mix.design").c_str());
+//a design table holds one grouping per column: an optional header line names the columns (its first field,
+//over the sample names, is ignored) and every following line gives a sample and its group in each column.
+//the first line is a header unless its first field is a sample name; columns without a header are named by
+//their position, or left unnamed when there is only one
 
-    vector<string> titles(numPartitions);
+inline void readDesignTable(string designFileName, vector<string>& sampleNames, vector<string>& columnNames, vector<vector<vector<double> > >& designs){
     
-    for(int i=0;i<numPartitions;i++){   postFile >> titles[i];  }
+    int numSamples = (int)sampleNames.size();
     
-    double posterior;
-    string sampleName;
-    int numSamples = 0;
+    ifstream designFile(designFileName.c_str());
+    if(!designFile){    throw inputError("could not open " + designFileName);  }
     
-    while(postFile){
-        double maxPosterior = 0.0000;
-        int maxPartition = -1;
-        
-        postFile >> sampleName;
-        
-        for(int i=0;i<numPartitions;i++){
-
-            postFile >> posterior;
-            if(posterior > maxPosterior){
-                maxPosterior = posterior;
-                maxPartition = i;
-            }
-            piValues[i] += posterior;
-            
-        }
+    vector<vector<string> > rows;
+    while(designFile){
+        string line = getline(designFile);
         
-        designFile << sampleName << '\t' << titles[maxPartition] << endl;
+        vector<string> fields;
+        string field;
+        istringstream lineStream(line);
+        while(lineStream >> field){ fields.push_back(field);    }
         
-        numSamples++;
-        gobble(postFile);
+        if(!fields.empty()){    rows.push_back(fields); }
+    }
+    designFile.close();
+    
+    if(rows.empty() || rows[0].size() < 2){ throw inputError(designFileName + " has no design columns.");  }
+    
+    int firstRow = 0;
+    if(find(sampleNames.begin(), sampleNames.end(), rows[0][0]) == sampleNames.end()){
+        columnNames.assign(rows[0].begin() + 1, rows[0].end());
+        firstRow = 1;
+    }
+    else if(rows[0].size() == 2){
+        columnNames.assign(1, "");
     }
-    for(int i=0;i<numPartitions;i++){
-        piValues[i] /= (double)numSamples;
+    else{
+        columnNames.clear();
+        for(int c=1;c<rows[0].size();c++){  columnNames.push_back(toString(c)); }
     }
     
+    int numColumns = (int)columnNames.size();
+    vector<map<string, int> > partitionIndex(numColumns);
+    designs.assign(numColumns, vector<vector<double> >());
     
-    postFile.close();
-    designFile.close();
+    for(int i=0;i<numSamples;i++){
+        if(firstRow + i >= rows.size() || rows[firstRow + i].size() != numColumns + 1){
+            throw inputError(designFileName + " needs a line with " + toString(numColumns + 1) + " fields for every sample.");
+        }
+        
+        vector<string>& fields = rows[firstRow + i];
+        if(fields[0] != sampleNames[i]){    cerr << fields[0] << "!=" << sampleNames[i] << endl;  continue;   }
+        
+        for(int c=0;c<numColumns;c++){
+            string& partition = fields[c + 1];
+            if(partitionIndex[c].count(partition) == 0){
+                partitionIndex[c][partition] = (int)designs[c].size();
+                designs[c].push_back(vector<double>(numSamples, 0));
+            }
+            designs[c][partitionIndex[c][partition]][i] = 1;
+        }
+    }
     
-    return piValues;
+    for(int c=0;c<numColumns;c++){
+        if(designs[c].empty()){ throw inputError(designFileName + " assigns no samples in column " + (columnNames[c] != "" ? columnNames[c] : toString(c + 1)) + ".");    }
+    }
 }
 
 /**************************************************************************************************/
@@ -212,112 +264,20 @@ struct summaryData {
 
 /**************************************************************************************************/
 
-inline bool summaryFunction(summaryData i, summaryData j){ return i.difference > j.difference;   }
+//orders otu indices by decreasing difference without copying the per-partition vectors
 
-/**************************************************************************************************/
-
-inline void generateSummaryFile(int numPartitions, string fileRoot){
-    
-    vector<summaryData> summary;
+struct summaryFunction {
     
-    vector<double> pMean(numPartitions, 0);
-    vector<double> pLCI(numPartitions, 0);
-    vector<double> pUCI(numPartitions, 0);
+    vector<summaryData>& summary;
     
-    string name, header;
-    double mean, lci, uci;
+    summaryFunction(vector<summaryData>& s) : summary(s) {}
+    bool operator()(int i, int j) const {   return summary[i].difference > summary[j].difference;   }
     
-   
-    vector<double> piValues = generateDesignFile(numPartitions, fileRoot);
-    
-    ifstream referenceFile((fileRoot + "1mix.relabund").c_str());
-    ifstream partitionFile((fileRoot + toString(numPartitions) + "mix.relabund").c_str());
-
-    header = getline(referenceFile);
-    header = getline(partitionFile);
-    stringstream head(header);
-    string dummy, label;
-    head >> dummy;
-    vector<string> thetaValues(numPartitions, "");
-    for(int i=0;i<numPartitions;i++){
-        head >> label >> dummy >> dummy;
-        thetaValues[i] = label.substr(label.find_last_of('_')+1);
-    }
-    
-    
-    vector<double> partitionDiff(numPartitions, 0.0000);
-
-    while(referenceFile){
-        referenceFile >> name >> mean >> lci >> uci;
-        
-        summaryData tempData;
-        tempData.name = name;
-        tempData.refMean = mean;
-        
-        double difference = 0.0000;
-        
-        partitionFile >> name;
-        for(int j=0;j<numPartitions;j++){
-            partitionFile >> pMean[j] >> pLCI[j] >> pUCI[j];
-            difference += abs(mean - pMean[j]);
-            partitionDiff[j] += abs(mean - pMean[j]);;
-        }
-
-        tempData.partMean = pMean;
-        tempData.partLCI = pLCI;
-        tempData.partUCI = pUCI;
-        tempData.difference = difference;
-        summary.push_back(tempData);
-        
-        gobble(referenceFile);
-        gobble(partitionFile);
-    }
-    referenceFile.close();
-    partitionFile.close();
+};
 
-    
-    int numOTUs = (int)summary.size();
-    
-    sort(summary.begin(), summary.end(), summaryFunction);
-    
-    
-    ofstream parameterFile((fileRoot + "mix.parameters").c_str());
-    parameterFile.setf(ios::fixed, ios::floatfield);
-    parameterFile.setf(ios::showpoint);
-
-    double totalDifference =  0.0000;
-    parameterFile << "Part\tDif2Ref_i\ttheta_i\tpi_i\n";
-    for(int i=0;i<numPartitions;i++){
-        parameterFile << i+1 << '\t' << setprecision(2) << partitionDiff[i] << '\t' << thetaValues[i] << '\t' << piValues[i] << endl;
-        totalDifference += partitionDiff[i];
-    }
-    parameterFile.close();
-    
-    ofstream summaryFile((fileRoot + "mix.summary").c_str());
-    summaryFile.setf(ios::fixed, ios::floatfield);
-    summaryFile.setf(ios::showpoint);
-    
-    
-    summaryFile << "OTU\tP0.mean";
-    for(int i=0;i<numPartitions;i++){
-        summaryFile << "\tP" << i+1 << ".mean\tP" << i+1 << ".lci\tP" << i+1 << ".uci";
-    }
-    summaryFile << "\tDifference\tCumFraction" << endl;
-    
-    double cumDiff = 0.0000;
-    
-    for(int i=0;i<numOTUs;i++){
-        summaryFile << summary[i].name << setprecision(2) << '\t' << summary[i].refMean;
-        for(int j=0;j<numPartitions;j++){
-            summaryFile  << '\t' << summary[i].partMean[j] << '\t' << summary[i].partLCI[j] << '\t' << summary[i].partUCI[j];
-        }
-        
-        cumDiff += summary[i].difference/totalDifference;
-        summaryFile << '\t' << summary[i].difference << '\t' << cumDiff << endl;
-    }
-    summaryFile.close();
+/**************************************************************************************************/
 
-}
+inline bool posteriorFunction(const pair<int, double>& i, const pair<int, double>& j){ return i.second > j.second;   }
 
 /**************************************************************************************************/
 
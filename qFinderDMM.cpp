@@ -13,79 +13,56 @@
 
 /**************************************************************************************************/
 
-qFinderDMM::qFinderDMM(vector<vector<int> > cm, int p): countMatrix(cm), numPartitions(p){
+//the dense count matrix is only referenced, never copied; out-of-core fits have none
+static const vector<vector<int> > noCounts;
+
+/**************************************************************************************************/
+
+qFinderDMM::qFinderDMM(const vector<vector<int> >& cm, int p, dmmOptions o): options(o), source(NULL), countMatrix(cm), numPartitions(p){
     
     numSamples = (int)countMatrix.size();
     numOTUs = (int)countMatrix[0].size();
+    sampleWeights.assign(numSamples, 1.0000);
+    totalWeight = numSamples;
     
+    //each K gets its own stream so a fit does not depend on which other K were fitted before it
+    seed_seq seeds = {options.seed, (unsigned int)numPartitions};
+    randomGenerator.seed(seeds);
     
     kMeans();
     optimizeLambda();
 
-    double change = 1.0000;
-    currNLL = 0.0000;
-    
-    int iter = 0;
-    
-    while(change > 1.0e-6 && iter < 100){
-        calculatePiK();
-        
-        optimizeLambda();
-        
-        for(int i=0;i<numPartitions;i++){
-            weights[i] = 0.0000;
-            for(int j=0;j<numSamples;j++){
-                weights[i] += zMatrix[i][j];
-            }
-        }
-        
-        double nLL = getNegativeLogLikelihood();
-        
-        change = abs(nLL - currNLL);
-        
-        currNLL = nLL;
-        
-        iter++;
-    }
-    
-    error.resize(numPartitions);
+    runEM(options.maxIterations);
+    calculateLaplace();
+}
 
-    logDeterminant = 0.0000;
-    
-    LinearAlgebra l;
+/**************************************************************************************************/
+
+qFinderDMM::qFinderDMM(const vector<vector<int> >& cm, const vector<vector<double> >& partitions): source(NULL), countMatrix(cm){
     
-    for(currentPartition=0;currentPartition<numPartitions;currentPartition++){
+    fitPartitions(getRelativeAbundance(countMatrix), partitions);
+}
 
-        error[currentPartition].assign(numOTUs, 0.0000);
-        
-        if(currentPartition > 0){
-            logDeterminant += (2.0 * log(numSamples) - log(weights[currentPartition]));
-        }
-        vector<vector<double> > hessian = getHessian();
-        vector<vector<double> > invHessian = l.getInverse(hessian);
-       
-        for(int i=0;i<numOTUs;i++){
-            logDeterminant += log(abs(hessian[i][i]));
-            error[currentPartition][i] = invHessian[i][i];
-        }
+/**************************************************************************************************/
 
-    }
+//the same design fit from relative abundances the caller computed once, so repeated fits of one table
+//(e.g. a permutation test) neither recompute nor copy them
+
+qFinderDMM::qFinderDMM(const vector<vector<int> >& cm, const vector<vector<double> >& relativeAbundance, const vector<vector<double> >& partitions): source(NULL), countMatrix(cm){
     
-    int numParameters = numPartitions * numOTUs + numPartitions - 1;
-    laplace = currNLL + 0.5 * logDeterminant - 0.5 * numParameters * log(2.0 * 3.14159);
-    bic = currNLL + 0.5 * log(numSamples) * numParameters;
-    aic = currNLL + numParameters;
+    fitPartitions(relativeAbundance, partitions);
 }
 
 /**************************************************************************************************/
 
-qFinderDMM::qFinderDMM(vector<vector<int> > cm, vector<vector<double> > partitions): countMatrix(cm){
+void qFinderDMM::fitPartitions(const vector<vector<double> >& relativeAbundance, const vector<vector<double> >& partitions){
     
     numSamples = (int)countMatrix.size();
     numOTUs = (int)countMatrix[0].size();
+    sampleWeights.assign(numSamples, 1.0000);
+    totalWeight = numSamples;
     numPartitions = (int) partitions.size();
     
-    vector<vector<double> > relativeAbundance(numSamples);
     vector<vector<double> > alphaMatrix(numPartitions);
     
     lambdaMatrix.resize(numPartitions);
@@ -94,35 +71,24 @@ qFinderDMM::qFinderDMM(vector<vector<int> > cm, vector<vector<double> > partitio
         lambdaMatrix[i].assign(numOTUs, 0);
     }
     
-    //get relative abundance
-    for(int i=0;i<numSamples;i++){
-        int groupTotal = 0;
-        
-        relativeAbundance[i].assign(numOTUs, 0.0);
-        
-        for(int j=0;j<numOTUs;j++){
-            groupTotal += countMatrix[i][j];
-        }
-        for(int j=0;j<numOTUs;j++){
-            relativeAbundance[i][j] = countMatrix[i][j] / (double)groupTotal;
-        }
-    }
-    
-    //assign samples into user supplied partitions
+    //assign samples into user supplied partitions; a design is (nearly always) a hard assignment, so the
+    //member lists of the partitions are all that the averages and the M-step kernels visit
     zMatrix = partitions;
+    refreshActiveSamples();
     
     weights.assign(numPartitions, 0);
     
     for(int i=0;i<numPartitions;i++){
-        for(int j=0;j<numSamples;j++){
-            weights[i] += zMatrix[i][j];
+        for(int a=0;a<activeSamples[i].size();a++){
+            weights[i] += zMatrix[i][activeSamples[i][a]];
         }
     }
     
     for(int i=0;i<numPartitions;i++){
         vector<double> averageRelativeAbundance(numOTUs, 0);
-        for(int j=0;j<numOTUs;j++){
-            for(int k=0;k<numSamples;k++){
+        for(int a=0;a<activeSamples[i].size();a++){
+            int k = activeSamples[i][a];
+            for(int j=0;j<numOTUs;j++){
                 averageRelativeAbundance[j] += zMatrix[i][k] * relativeAbundance[k][j];
             }
         }
@@ -145,103 +111,307 @@ qFinderDMM::qFinderDMM(vector<vector<int> > cm, vector<vector<double> > partitio
     }
     
     optimizeLambda();
-    double nLL = getNegativeLogLikelihood();
+    currNLL = getNegativeLogLikelihood();
 
-    error.resize(numPartitions);
-    
-    logDeterminant = 0.0000;
+    calculateLaplace();
+}
+
+/**************************************************************************************************/
+
+vector<vector<double> > getRelativeAbundance(const vector<vector<int> >& countMatrix){
     
-    LinearAlgebra l;
+    int numSamples = (int)countMatrix.size();
+    vector<vector<double> > relativeAbundance(numSamples);
     
-    for(currentPartition=0;currentPartition<numPartitions;currentPartition++){
+    for(int i=0;i<numSamples;i++){
+        int numOTUs = (int)countMatrix[i].size();
+        int groupTotal = 0;
         
-        error[currentPartition].assign(numOTUs, 0.0000);
+        relativeAbundance[i].assign(numOTUs, 0.0);
         
-        if(currentPartition > 0){
-            logDeterminant += (2.0 * log(numSamples) - log(weights[currentPartition]));
+        for(int j=0;j<numOTUs;j++){
+            groupTotal += countMatrix[i][j];
         }
-        vector<vector<double> > hessian = getHessian();
-        vector<vector<double> > invHessian = l.getInverse(hessian);
-        
-        for(int i=0;i<numOTUs;i++){
-            logDeterminant += log(abs(hessian[i][i]));
-            error[currentPartition][i] = invHessian[i][i];
+        for(int j=0;j<numOTUs;j++){
+            relativeAbundance[i][j] = countMatrix[i][j] / (double)groupTotal;
         }
-        
     }
     
-    int numParameters = numPartitions * numOTUs + numPartitions - 1;
-    laplace = nLL + 0.5 * logDeterminant - 0.5 * numParameters * log(2.0 * 3.14159);
-    bic = nLL + 0.5 * log(numSamples) * numParameters;
-    aic = nLL + numParameters;
-    currNLL = nLL;
+    return relativeAbundance;
 }
 
 /**************************************************************************************************/
 
+//out-of-core fit: the counts are only seen in passes over the blocks of the source and the M-step works
+//from per-partition sufficient statistics gathered during the E-step pass
 
+qFinderDMM::qFinderDMM(CountSource& s, int p, dmmOptions o): options(o), source(&s), countMatrix(noCounts), numPartitions(p){
+    
+    numSamples = source->getNumSamples();
+    numOTUs = source->getNumOTUs();
+    readSampleWeights();
+    
+    seed_seq seeds = {options.seed, (unsigned int)numPartitions};
+    randomGenerator.seed(seeds);
+    
+    streamKMeans();
+    streamStatistics();
+    optimizeLambda();
+    
+    if(options.batchSize > 0){
+        stochasticEM();
+        runEM(options.finalPasses);
+    }
+    else{
+        runEM(options.maxIterations);
+    }
+    calculateLaplace();
+}
+
+/**************************************************************************************************/
+
+//warm starts begin from the lambdas and weights of an earlier fit (already lined up with these OTUs)
+//instead of kMeans; the first E-step then places any new samples
+
+qFinderDMM::qFinderDMM(const vector<vector<int> >& cm, const dmmResults& start, dmmOptions o): options(o), source(NULL), countMatrix(cm), numPartitions(start.numPartitions){
+    
+    numSamples = (int)countMatrix.size();
+    numOTUs = (int)countMatrix[0].size();
+    sampleWeights.assign(numSamples, 1.0000);
+    totalWeight = numSamples;
+    
+    warmStart(start);
+    runEM(options.maxIterations);
+    calculateLaplace();
+}
+
+/**************************************************************************************************/
 
-void qFinderDMM::printZMatrix(string fileName, vector<string> sampleName){
+qFinderDMM::qFinderDMM(CountSource& s, const dmmResults& start, dmmOptions o): options(o), source(&s), countMatrix(noCounts), numPartitions(start.numPartitions){
     
-    ofstream printMatrix(fileName.c_str());
-    printMatrix.setf(ios::fixed, ios::floatfield);
-    printMatrix.setf(ios::showpoint);
+    numSamples = source->getNumSamples();
+    numOTUs = source->getNumOTUs();
+    readSampleWeights();
+    
+    warmStart(start);
+    runEM(options.maxIterations);
+    calculateLaplace();
+}
+
+/**************************************************************************************************/
 
-    for(int i=0;i<numPartitions;i++){   printMatrix << "\tPartition_" << i+1;   }   printMatrix << endl;
+//the previous weights are rescaled to the total weight of these samples
+
+void qFinderDMM::warmStart(const dmmResults& start){
     
-    for(int i=0;i<numSamples;i++){
-        printMatrix << sampleName[i];
-        for(int j=0;j<numPartitions;j++){
-            printMatrix << setprecision(4) << '\t' << zMatrix[j][i];
+    lambdaMatrix = start.lambdaMatrix;
+    
+    double startWeight = 0.0000;
+    for(int i=0;i<numPartitions;i++){   startWeight += start.weights[i];    }
+    
+    weights.resize(numPartitions);
+    for(int i=0;i<numPartitions;i++){   weights[i] = start.weights[i] * totalWeight / startWeight;  }
+    
+    zMatrix.resize(numPartitions);
+    for(int i=0;i<numPartitions;i++){   zMatrix[i].assign(numSamples, 0.0000);  }
+}
+
+/**************************************************************************************************/
+
+//EM from the current lambdas and weights until the NLL changes by less than the tolerance or
+//maxIterations full passes were made
+
+void qFinderDMM::runEM(int maxIterations){
+    
+    double change = 1.0000;
+    currNLL = 0.0000;
+    
+    int iter = 0;
+    
+    while(change > options.tolerance && iter < maxIterations){
+        if(source != NULL)  {   streamPosteriors(); }
+        else                {   calculatePiK();     }
+        
+        //the statistics were gathered during the E-step pass, so they are rebuilt once samples move
+        if(options.classificationEM && reseedEmptyPartitions() && source != NULL){  streamStatistics();   }
+        
+        optimizeLambda();
+        sumPartitionWeights();
+        
+        double nLL = (source != NULL) ? streamNegativeLogLikelihood() : getNegativeLogLikelihood();
+        
+        change = abs(nLL - currNLL);
+        
+        currNLL = nLL;
+        
+        iter++;
+        
+        if(options.progress){   options.progress(numPartitions, iter, currNLL); }
+    }
+}
+
+/**************************************************************************************************/
+
+//online EM: every mini-batch of samples gets a fresh E-step, its statistics are scaled up to the whole
+//data set and blended into the running statistics with step size (t + 1)^-0.7, and the lambdas are
+//re-optimized from the blend. the M-step works on the distinct (otu, count) slots, so its cost hardly
+//grows with the number of samples. mini-batches are drawn in random order within each block of the
+//source, which for in-memory data means across all samples
+
+void qFinderDMM::stochasticEM(){
+    
+    double stepDecay = 0.7000;
+    int step = 0;
+    
+    vector<double> store(numPartitions);
+    vector<double> batchWeights(numPartitions);
+    vector<int> order;
+    
+    for(int pass=0;pass<options.stochasticPasses;pass++){
+        source->rewind();
+        while(const countBlock* block = source->nextBlock()){
+            order.resize(block->numSamples);
+            for(int i=0;i<block->numSamples;i++){   order[i] = i;   }
+            shuffle(order.begin(), order.end(), randomGenerator);
+            
+            for(int start=0;start<block->numSamples;start+=options.batchSize){
+                int end = min(start + options.batchSize, block->numSamples);
+                
+                double batchTotal = 0.0000;
+                for(int i=start;i<end;i++){ batchTotal += sampleWeights[block->firstSample + order[i]];   }
+                if(batchTotal == 0){    continue;   }
+                
+                double stepSize = pow(step + 1.0, -stepDecay);
+                double scale = stepSize * totalWeight / batchTotal;
+                
+                prepareEvidence();
+                scaleStatistics(1.0 - stepSize);
+                batchWeights.assign(numPartitions, 0.0000);
+                
+                //the E-step uses the weights from before this batch, so they are blended afterwards
+                for(int i=start;i<end;i++){
+                    int row = order[i];
+                    updatePosterior(*block, row, store);
+                    addToStatistics(*block, row, scale);
+                    
+                    for(int j=0;j<numPartitions;j++){
+                        batchWeights[j] += sampleWeights[block->firstSample + row] * zMatrix[j][block->firstSample + row];
+                    }
+                }
+                for(int j=0;j<numPartitions;j++){
+                    weights[j] = (1.0 - stepSize) * weights[j] + scale * batchWeights[j];
+                }
+                
+                optimizeLambda();
+                step++;
+            }
         }
-        printMatrix << endl;
+        
+        if(options.progress){   options.progress(numPartitions, -(pass + 1), 0.0000);   }
     }
-    printMatrix.close();
 }
 
 /**************************************************************************************************/
 
-void qFinderDMM::printRelAbund(string fileName, vector<string> otuNames){
+void qFinderDMM::scaleStatistics(double factor){
+    
+    for(int i=0;i<numOTUs;i++){
+        for(int s=0;s<countWeights[i].size();s++){  countWeights[i][s] *= factor;   }
+    }
+    for(int t=0;t<totalWeights.size();t++){ totalWeights[t] *= factor;  }
+}
 
-    ofstream printRA(fileName.c_str());
-    printRA.setf(ios::fixed, ios::floatfield);
-    printRA.setf(ios::showpoint);
+/**************************************************************************************************/
 
-    vector<double> totals(numPartitions, 0.0000);
+qFinderDMM::qFinderDMM(CountSource& s, const vector<vector<double> >& partitions, dmmOptions o): options(o), source(&s), countMatrix(noCounts){
+    
+    numSamples = source->getNumSamples();
+    numOTUs = source->getNumOTUs();
+    readSampleWeights();
+    numPartitions = (int) partitions.size();
+    
+    zMatrix = partitions;
+    sumPartitionWeights();
+    
+    vector<vector<double> > alphaMatrix(numPartitions);
+    vector<vector<double> > sums(numPartitions);
     for(int i=0;i<numPartitions;i++){
-        for(int j=0;j<numOTUs;j++){
-            totals[i] += exp(lambdaMatrix[i][j]);
-        }
+        alphaMatrix[i].assign(numOTUs, 0);
+        sums[i].assign(numOTUs, 0);
     }
+    streamKMeansPass(alphaMatrix, sums, false);
     
-    printRA << "Taxon";
+    lambdaMatrix.resize(numPartitions);
     for(int i=0;i<numPartitions;i++){
-        printRA << "\tPartition_" << i+1 << '_' << setprecision(4) << totals[i];
-        printRA << "\tPartition_" << i+1 <<"_LCI" << "\tPartition_" << i+1 << "_UCI";
+        lambdaMatrix[i].assign(numOTUs, 0);
+        for(int j=0;j<numOTUs;j++){
+            double average = sums[i][j] / weights[i];
+            lambdaMatrix[i][j] = (average > 0) ? log(average) : -10.0;
+        }
     }
-    printRA << endl;
     
-    for(int i=0;i<numOTUs;i++){
+    streamStatistics();
+    optimizeLambda();
+    currNLL = streamNegativeLogLikelihood();
+    
+    calculateLaplace();
+}
+
+/**************************************************************************************************/
+
+void qFinderDMM::calculateLaplace(){
+    
+    error.resize(numPartitions);
+
+    logDeterminant = 0.0000;
+    
+    LinearAlgebra l;
+    
+    for(currentPartition=0;currentPartition<numPartitions;currentPartition++){
+
+        error[currentPartition].assign(numOTUs, 0.0000);
         
-        printRA << otuNames[i];
-        for(int j=0;j<numPartitions;j++){
-            
-            if(error[j][i] >= 0.0000){
-                double std = sqrt(error[j][i]);
-                printRA << '\t' << 100 * exp(lambdaMatrix[j][i]) / totals[j];
-                printRA << '\t' << 100 * exp(lambdaMatrix[j][i] - 2.0 * std) / totals[j];
-                printRA << '\t' << 100 * exp(lambdaMatrix[j][i] + 2.0 * std) / totals[j];
-            }
-            else{
-                printRA << '\t' << 100 * exp(lambdaMatrix[j][i]) / totals[j];
-                printRA << '\t' << "NA";
-                printRA << '\t' << "NA";
-            }
+        if(currentPartition > 0){
+            logDeterminant += (2.0 * log(totalWeight) - log(weights[currentPartition]));
+        }
+        vector<vector<double> > hessian = getHessian();
+        vector<vector<double> > invHessian = l.getInverse(hessian);
+       
+        for(int i=0;i<numOTUs;i++){
+            logDeterminant += log(abs(hessian[i][i]));
+            error[currentPartition][i] = invHessian[i][i];
         }
-        printRA << endl;
+
     }
     
-    printRA.close();
+    int numParameters = numPartitions * numOTUs + numPartitions - 1;
+    laplace = currNLL + 0.5 * logDeterminant - 0.5 * numParameters * log(2.0 * 3.14159);
+    bic = currNLL + 0.5 * log(totalWeight) * numParameters;
+    aic = currNLL + numParameters;
+}
+
+/**************************************************************************************************/
+
+dmmResults qFinderDMM::getResults(){
+
+    dmmResults results;
+
+    results.numPartitions = numPartitions;
+    results.numSamples = numSamples;
+    results.numOTUs = numOTUs;
+
+    results.nll = currNLL;
+    results.logDeterminant = logDeterminant;
+    results.bic = bic;
+    results.aic = aic;
+    results.laplace = laplace;
+
+    results.weights = weights;
+    results.zMatrix = zMatrix;
+    results.lambdaMatrix = lambdaMatrix;
+    results.error = error;
+
+    return results;
 }
 
 /**************************************************************************************************/
@@ -678,7 +848,7 @@ int qFinderDMM::bfgs2_Solver(vector<double>& x){
         return bfgsIter;
     }
     catch(exception& e){
-        cout << "caught exception in bfgs2_Solver" << endl;
+        cerr << "caught exception in bfgs2_Solver" << endl;
     }
 }
 
@@ -839,6 +1009,8 @@ double qFinderDMM::psi1(double xx){
 
 double qFinderDMM::negativeLogEvidenceLambdaPi(vector<double>& x){
     try{
+        if(source != NULL){ return statsNegativeLogEvidence(x);    }
+        
         vector<double> sumAlphaX(numSamples, 0.0000);
         
         double logEAlpha = 0.0000;
@@ -848,9 +1020,11 @@ double qFinderDMM::negativeLogEvidenceLambdaPi(vector<double>& x){
         double nu = 0.10000;
         double eta = 0.10000;
         
+        vector<int>& active = activeSamples[currentPartition];
+        
         double weight = 0.00000;
-        for(int i=0;i<numSamples;i++){
-            weight += zMatrix[currentPartition][i];
+        for(int a=0;a<active.size();a++){
+            weight += zMatrix[currentPartition][active[a]];
         }
         
         for(int i=0;i<numOTUs;i++){
@@ -860,7 +1034,8 @@ double qFinderDMM::negativeLogEvidenceLambdaPi(vector<double>& x){
             sumLambda += lambda;
             sumAlpha += alpha;
             
-            for(int j=0;j<numSamples;j++){
+            for(int a=0;a<active.size();a++){
+                int j = active[a];
                 double X = countMatrix[j][i];
                 double alphaX = alpha + X;
                 sumAlphaX[j] += alphaX;
@@ -871,14 +1046,14 @@ double qFinderDMM::negativeLogEvidenceLambdaPi(vector<double>& x){
         
         logEAlpha -= lgamma(sumAlpha);
 
-        for(int i=0;i<numSamples;i++){
-            logE += zMatrix[currentPartition][i] * lgamma(sumAlphaX[i]);
+        for(int a=0;a<active.size();a++){
+            logE += zMatrix[currentPartition][active[a]] * lgamma(sumAlphaX[active[a]]);
         }
 
         return logE + weight * logEAlpha + nu * sumAlpha - eta * sumLambda;
     }
     catch(exception& e){
-        cout << "caught exception in negativeLogEvidenceLambdaPi" << endl;
+        cerr << "caught exception in negativeLogEvidenceLambdaPi" << endl;
         exit(1);
     }
 }
@@ -887,6 +1062,8 @@ double qFinderDMM::negativeLogEvidenceLambdaPi(vector<double>& x){
 
 void qFinderDMM::negativeLogDerivEvidenceLambdaPi(vector<double>& x, vector<double>& df){
     try{
+        if(source != NULL){ statsNegativeLogDerivEvidence(x, df);  return; }
+        
         vector<double> storeVector(numSamples, 0.0000);
         vector<double> derivative(numOTUs, 0.0000);
         vector<double> alpha(numOTUs, 0.0000);
@@ -895,9 +1072,11 @@ void qFinderDMM::negativeLogDerivEvidenceLambdaPi(vector<double>& x, vector<doub
         double nu = 0.1000;
         double eta = 0.1000;
         
+        vector<int>& active = activeSamples[currentPartition];
+        
         double weight = 0.0000;
-        for(int i=0;i<numSamples;i++){
-            weight += zMatrix[currentPartition][i];
+        for(int a=0;a<active.size();a++){
+            weight += zMatrix[currentPartition][active[a]];
         }
 
         
@@ -908,7 +1087,8 @@ void qFinderDMM::negativeLogDerivEvidenceLambdaPi(vector<double>& x, vector<doub
             
             derivative[i] = weight * psi(alpha[i]);
 
-            for(int j=0;j<numSamples;j++){
+            for(int a=0;a<active.size();a++){
+                int j = active[a];
                 double X = countMatrix[j][i];
                 double alphaX = X + alpha[i];
                 
@@ -918,8 +1098,8 @@ void qFinderDMM::negativeLogDerivEvidenceLambdaPi(vector<double>& x, vector<doub
         }
 
         double sumStore = 0.0000;
-        for(int i=0;i<numSamples;i++){
-            sumStore += zMatrix[currentPartition][i] * psi(storeVector[i]);
+        for(int a=0;a<active.size();a++){
+            sumStore += zMatrix[currentPartition][active[a]] * psi(storeVector[active[a]]);
         }
         
         store = weight * psi(store);
@@ -931,7 +1111,7 @@ void qFinderDMM::negativeLogDerivEvidenceLambdaPi(vector<double>& x, vector<doub
         }
     }
     catch(exception& e){
-        cout << "caught error in qFinderDMM::negativeLogDerivEvidenceLambdaPi" << endl;
+        cerr << "caught error in qFinderDMM::negativeLogDerivEvidenceLambdaPi" << endl;
         exit(1);
     }
 }
@@ -998,7 +1178,7 @@ void qFinderDMM::kMeans(){
     }
     
     for(int i=0;i<numSamples;i++){
-        zMatrix[rand()%numPartitions][i] = 1;
+        zMatrix[randomGenerator()%numPartitions][i] = 1;
     }
     
     double maxChange = 1;
@@ -1092,6 +1272,8 @@ void qFinderDMM::kMeans(){
 
 void qFinderDMM::optimizeLambda(){    
 
+    if(source == NULL){ refreshActiveSamples();  }
+    
     for(currentPartition=0;currentPartition<numPartitions;currentPartition++){
         bfgs2_Solver(lambdaMatrix[currentPartition]);
     }
@@ -1100,6 +1282,22 @@ void qFinderDMM::optimizeLambda(){
 
 /**************************************************************************************************/
 
+//the samples whose posterior for a partition is above the threshold; the dense M-step kernels of a
+//partition only visit these, so their cost follows the size of the partition rather than the data
+
+void qFinderDMM::refreshActiveSamples(){
+    
+    activeSamples.resize(numPartitions);
+    for(int i=0;i<numPartitions;i++){
+        activeSamples[i].clear();
+        for(int j=0;j<numSamples;j++){
+            if(zMatrix[i][j] > options.activeThreshold){    activeSamples[i].push_back(j);  }
+        }
+    }
+}
+
+/**************************************************************************************************/
+
 void qFinderDMM::calculatePiK(){
 
     vector<double> store(numPartitions);
@@ -1125,6 +1323,8 @@ void qFinderDMM::calculatePiK(){
         for(int j=0;j<numPartitions;j++){
             zMatrix[j][i] /= sum;
         }
+        
+        if(options.classificationEM){   hardenPosterior(i, store);  }
 
     }
     
@@ -1222,10 +1422,13 @@ double qFinderDMM::getNegativeLogLikelihood(){
 
 vector<vector<double> > qFinderDMM::getHessian(){
     
+    if(source != NULL){ return getStatsHessian();   }
+    
     vector<double> alpha(numOTUs, 0.0000);
     double alphaSum = 0.0000;
     
-    vector<double> pi = zMatrix[currentPartition];
+    vector<double>& pi = zMatrix[currentPartition];
+    vector<int>& active = activeSamples[currentPartition];
     vector<double> psi_ajk(numOTUs, 0.0000);
     vector<double> psi_cjk(numOTUs, 0.0000);
     vector<double> psi1_ajk(numOTUs, 0.0000);
@@ -1235,7 +1438,8 @@ vector<vector<double> > qFinderDMM::getHessian(){
         alpha[j] = exp(lambdaMatrix[currentPartition][j]);
         alphaSum += alpha[j];
 
-        for(int i=0;i<numSamples;i++){
+        for(int a=0;a<active.size();a++){
+            int i = active[a];
             double X = (double) countMatrix[i][j];
             
             psi_ajk[j] += pi[i] * psi(alpha[j]);
@@ -1252,7 +1456,8 @@ vector<vector<double> > qFinderDMM::getHessian(){
 
     double weight = 0.0000;
     
-    for(int i=0;i<numSamples;i++){
+    for(int a=0;a<active.size();a++){
+        int i = active[a];
         weight += pi[i];
         double sum = 0.0000;
         for(int j=0;j<numOTUs;j++){     sum += alpha[j] + countMatrix[i][j];    }
@@ -1284,3 +1489,595 @@ vector<vector<double> > qFinderDMM::getHessian(){
 }
 
 /**************************************************************************************************/
+
+//out-of-core versions of kMeans, calculatePiK, getNegativeLogLikelihood and the M-step kernels; the
+//counts arrive as sparse rows, so anything that depends on zero counts is folded into per-otu terms
+
+/**************************************************************************************************/
+
+void qFinderDMM::streamKMeans(){
+    
+    vector<vector<double> > alphaMatrix(numPartitions);
+    vector<vector<double> > sums(numPartitions);
+    
+    lambdaMatrix.resize(numPartitions);
+    for(int i=0;i<numPartitions;i++){
+        alphaMatrix[i].assign(numOTUs, 0);
+        sums[i].assign(numOTUs, 0);
+        lambdaMatrix[i].assign(numOTUs, 0);
+    }
+    
+    //randomly assign samples into partitions
+    zMatrix.resize(numPartitions);
+    for(int i=0;i<numPartitions;i++){
+        zMatrix[i].assign(numSamples, 0);
+    }
+    
+    for(int i=0;i<numSamples;i++){
+        zMatrix[randomGenerator()%numPartitions][i] = 1;
+    }
+    
+    double maxChange = 1;
+    int maxIters = 1000;
+    int iteration = 0;
+    
+    weights.assign(numPartitions, 0);
+    
+    streamKMeansPass(alphaMatrix, sums, false);
+    
+    while(maxChange > 1e-6 && iteration < maxIters){
+        
+        //the partition averages come from the sums gathered on the previous pass
+        maxChange = 0.0000;
+        for(int i=0;i<numPartitions;i++){
+            
+            double normChange = 0.0;
+            
+            weights[i] = 0;
+            for(int j=0;j<numSamples;j++){
+                weights[i] += sampleWeights[j] * zMatrix[i][j];
+            }
+            
+            for(int j=0;j<numOTUs;j++){
+                double average = (weights[i] > 0) ? sums[i][j] / weights[i] : 0.0000;
+                double difference = average - alphaMatrix[i][j];
+                normChange += difference * difference;
+                alphaMatrix[i][j] = average;
+            }
+            
+            normChange = sqrt(normChange);
+            
+            if(normChange > maxChange){ maxChange = normChange; }
+        }
+        
+        streamKMeansPass(alphaMatrix, sums, true);
+        
+        iteration++;
+    }
+    
+    sumPartitionWeights();
+    
+    for(int i=0;i<numOTUs;i++){
+        for(int j=0;j<numPartitions;j++){
+            if(alphaMatrix[j][i] > 0){
+                lambdaMatrix[j][i] = log(alphaMatrix[j][i]);
+            }
+            else{
+                lambdaMatrix[j][i] = -10.0;
+            }
+        }
+    }
+}
+
+/**************************************************************************************************/
+
+//one pass over the samples: optionally reassign each sample from its distance to the partition averages,
+//then add its relative abundances to the zMatrix weighted sums used for the next averages
+
+void qFinderDMM::streamKMeansPass(vector<vector<double> >& alphaMatrix, vector<vector<double> >& sums, bool updateZ){
+    
+    vector<double> alphaNorm(numPartitions, 0.0000);
+    for(int i=0;i<numPartitions;i++){
+        for(int j=0;j<numOTUs;j++){ alphaNorm[i] += alphaMatrix[i][j] * alphaMatrix[i][j];  }
+        sums[i].assign(numOTUs, 0.0000);
+    }
+    
+    vector<double> totalDistToPartition(numPartitions);
+    
+    source->rewind();
+    while(const countBlock* block = source->nextBlock()){
+        for(int row=0;row<block->numSamples;row++){
+            int sample = block->firstSample + row;
+            double groupTotal = (double)block->totals[row];
+            
+            if(updateZ){
+                double relAbundNorm = 0.0000;
+                for(int k=block->rowStart[row];k<block->rowStart[row+1];k++){
+                    double relAbund = block->counts[k] / groupTotal;
+                    relAbundNorm += relAbund * relAbund;
+                }
+                
+                double normalizationFactor = 0;
+                for(int j=0;j<numPartitions;j++){
+                    double crossProduct = 0.0000;
+                    for(int k=block->rowStart[row];k<block->rowStart[row+1];k++){
+                        crossProduct += alphaMatrix[j][block->otus[k]] * block->counts[k] / groupTotal;
+                    }
+                    totalDistToPartition[j] = sqrt(max(0.0, alphaNorm[j] - 2.0 * crossProduct + relAbundNorm));
+                    normalizationFactor += exp(-50.0 * totalDistToPartition[j]);
+                }
+                
+                for(int j=0;j<numPartitions;j++){
+                    zMatrix[j][sample] = exp(-50.0 * totalDistToPartition[j]) / normalizationFactor;
+                }
+            }
+            
+            for(int j=0;j<numPartitions;j++){
+                double z = sampleWeights[sample] * zMatrix[j][sample];
+                if(z == 0){ continue;   }
+                for(int k=block->rowStart[row];k<block->rowStart[row+1];k++){
+                    sums[j][block->otus[k]] += z * block->counts[k] / groupTotal;
+                }
+            }
+        }
+    }
+}
+
+/**************************************************************************************************/
+
+//per partition terms of the evidence that do not depend on the sample
+
+void qFinderDMM::prepareEvidence(){
+    
+    alphaValues.resize(numPartitions);
+    lnGammaAlpha.resize(numPartitions);
+    sumAlpha.assign(numPartitions, 0.0000);
+    
+    for(int i=0;i<numPartitions;i++){
+        alphaValues[i].resize(numOTUs);
+        lnGammaAlpha[i].resize(numOTUs);
+        for(int j=0;j<numOTUs;j++){
+            alphaValues[i][j] = exp(lambdaMatrix[i][j]);
+            lnGammaAlpha[i][j] = lgamma(alphaValues[i][j]);
+            sumAlpha[i] += alphaValues[i][j];
+        }
+    }
+}
+
+/**************************************************************************************************/
+
+//same value as getNegativeLogEvidence for every partition; the lgamma(alpha) and lgamma(alpha + 0) terms of
+//the zero counts cancel, so only the nonzero counts are visited
+
+void qFinderDMM::getBlockNegativeLogEvidence(const countBlock& block, int row, vector<double>& store){
+    
+    for(int j=0;j<numPartitions;j++){
+        double logEvidence = lgamma(sumAlpha[j] + block.totals[row]) - lgamma(sumAlpha[j]);
+        
+        for(int k=block.rowStart[row];k<block.rowStart[row+1];k++){
+            int otu = block.otus[k];
+            logEvidence -= lgamma(alphaValues[j][otu] + block.counts[k]) - lnGammaAlpha[j][otu];
+        }
+        store[j] = logEvidence;
+    }
+}
+
+/**************************************************************************************************/
+
+void qFinderDMM::clearStatistics(){
+    
+    countValues.resize(numOTUs);
+    countWeights.resize(numOTUs);
+    countSlots.resize(numOTUs);
+    
+    for(int i=0;i<numOTUs;i++){ countWeights[i].assign(countWeights[i].size(), 0.0000);  }
+    totalWeights.assign(totalWeights.size(), 0.0000);
+}
+
+/**************************************************************************************************/
+
+//finds, or adds, the slot of a count value and returns its per-partition weights
+
+static double* getSlotWeights(unordered_map<int, int>& slots, vector<int>& values, vector<double>& slotWeights, int value, int numPartitions){
+    
+    int slot;
+    unordered_map<int, int>::iterator it = slots.find(value);
+    
+    if(it == slots.end()){
+        slot = (int)values.size();
+        slots[value] = slot;
+        values.push_back(value);
+        slotWeights.resize((slot + 1) * numPartitions, 0.0000);
+    }
+    else{
+        slot = it->second;
+    }
+    return &slotWeights[slot * numPartitions];
+}
+
+/**************************************************************************************************/
+
+void qFinderDMM::addToStatistics(const countBlock& block, int row, double scale){
+    
+    int sample = block.firstSample + row;
+    scale *= sampleWeights[sample];
+    
+    for(int k=block.rowStart[row];k<block.rowStart[row+1];k++){
+        int otu = block.otus[k];
+        double* slotWeights = getSlotWeights(countSlots[otu], countValues[otu], countWeights[otu], block.counts[k], numPartitions);
+        
+        for(int j=0;j<numPartitions;j++){
+            if(zMatrix[j][sample] > options.activeThreshold){   slotWeights[j] += scale * zMatrix[j][sample];   }
+        }
+    }
+    
+    double* slotWeights = getSlotWeights(totalSlots, totalValues, totalWeights, block.totals[row], numPartitions);
+    for(int j=0;j<numPartitions;j++){
+        if(zMatrix[j][sample] > options.activeThreshold){   slotWeights[j] += scale * zMatrix[j][sample];   }
+    }
+}
+
+/**************************************************************************************************/
+
+void qFinderDMM::readSampleWeights(){
+    
+    sampleWeights.assign(numSamples, 1.0000);
+    totalWeight = 0.0000;
+    
+    if(const vector<double>* w = source->getSampleWeights()){
+        sampleWeights = *w;
+        for(int i=0;i<numSamples;i++){  totalWeight += sampleWeights[i];    }
+        return;
+    }
+    
+    source->rewind();
+    while(const countBlock* block = source->nextBlock()){
+        for(int row=0;row<block->numSamples;row++){
+            sampleWeights[block->firstSample + row] = block->getWeight(row);
+            totalWeight += block->getWeight(row);
+        }
+    }
+}
+
+/**************************************************************************************************/
+
+//weights[k] is the weighted number of samples in partition k
+
+void qFinderDMM::sumPartitionWeights(){
+    
+    weights.assign(numPartitions, 0.0000);
+    for(int i=0;i<numPartitions;i++){
+        for(int j=0;j<numSamples;j++){
+            weights[i] += sampleWeights[j] * zMatrix[i][j];
+        }
+    }
+}
+
+/**************************************************************************************************/
+
+void qFinderDMM::streamStatistics(){
+    
+    clearStatistics();
+    
+    source->rewind();
+    while(const countBlock* block = source->nextBlock()){
+        for(int row=0;row<block->numSamples;row++){
+            addToStatistics(*block, row, 1.0000);
+        }
+    }
+}
+
+/**************************************************************************************************/
+
+//E-step pass: calculatePiK for every sample, gathering the statistics of the new zMatrix on the way
+
+void qFinderDMM::streamPosteriors(){
+    
+    prepareEvidence();
+    clearStatistics();
+    
+    vector<double> store(numPartitions);
+    
+    source->rewind();
+    while(const countBlock* block = source->nextBlock()){
+        for(int row=0;row<block->numSamples;row++){
+            updatePosterior(*block, row, store);
+            addToStatistics(*block, row, 1.0000);
+        }
+    }
+}
+
+/**************************************************************************************************/
+
+//E-step for one row of a block; prepareEvidence must have been called for the current lambdas
+
+void qFinderDMM::updatePosterior(const countBlock& block, int row, vector<double>& store){
+    
+    int sample = block.firstSample + row;
+    
+    getBlockNegativeLogEvidence(block, row, store);
+    
+    //the weights are folded in before the offset is taken, so a partition that has lost all of its weight
+    //cannot be the only one with a nonzero term
+    double minNegLogEvidence = numeric_limits<double>::max();
+    for(int j=0;j<numPartitions;j++){
+        zMatrix[j][sample] = store[j] - log(weights[j]);
+        if(zMatrix[j][sample] < minNegLogEvidence){ minNegLogEvidence = zMatrix[j][sample]; }
+    }
+    
+    double sum = 0.0000;
+    for(int j=0;j<numPartitions;j++){
+        zMatrix[j][sample] = exp(-(zMatrix[j][sample] - minNegLogEvidence));
+        sum += zMatrix[j][sample];
+    }
+    for(int j=0;j<numPartitions;j++){
+        zMatrix[j][sample] /= sum;
+    }
+    
+    if(options.classificationEM){   hardenPosterior(sample, store); }
+}
+
+/**************************************************************************************************/
+
+//classification EM: the sample goes wholly to its most probable partition, and the negative log evidence
+//of the sample under that partition is kept for reseedEmptyPartitions
+
+void qFinderDMM::hardenPosterior(int sample, const vector<double>& negLogEvidence){
+    
+    int best = 0;
+    for(int j=1;j<numPartitions;j++){
+        if(zMatrix[j][sample] > zMatrix[best][sample]){ best = j;   }
+    }
+    for(int j=0;j<numPartitions;j++){
+        zMatrix[j][sample] = (j == best) ? 1.0000 : 0.0000;
+    }
+    
+    assignedEvidence.resize(numSamples);
+    assignedEvidence[sample] = negLogEvidence[best];
+}
+
+/**************************************************************************************************/
+
+//after a classification E-step every partition without members takes the worst fitting sample of a
+//partition that has more than one, so no partition reaches the M-step or the Laplace approximation with
+//zero weight. returns whether any sample moved
+
+bool qFinderDMM::reseedEmptyPartitions(){
+    
+    vector<int> partitionOf(numSamples, -1);
+    vector<int> numMembers(numPartitions, 0);
+    for(int i=0;i<numSamples;i++){
+        if(sampleWeights[i] == 0){  continue;   }
+        for(int j=0;j<numPartitions;j++){
+            if(zMatrix[j][i] == 1){ partitionOf[i] = j; }
+        }
+        numMembers[partitionOf[i]]++;
+    }
+    
+    bool moved = false;
+    for(int j=0;j<numPartitions;j++){
+        if(numMembers[j] > 0){  continue;   }
+        
+        int worst = -1;
+        for(int i=0;i<numSamples;i++){
+            if(partitionOf[i] == -1 || numMembers[partitionOf[i]] < 2){ continue;   }
+            if(worst == -1 || assignedEvidence[i] > assignedEvidence[worst]){   worst = i;  }
+        }
+        if(worst == -1){    break;  }
+        
+        zMatrix[partitionOf[worst]][worst] = 0.0000;
+        zMatrix[j][worst] = 1.0000;
+        numMembers[partitionOf[worst]]--;
+        numMembers[j]++;
+        partitionOf[worst] = j;
+        moved = true;
+    }
+    
+    return moved;
+}
+
+/**************************************************************************************************/
+
+double qFinderDMM::streamNegativeLogLikelihood(){
+    
+    double eta = 0.10000;
+    double nu = 0.10000;
+    
+    prepareEvidence();
+    
+    vector<double> pi(numPartitions, 0.0000);
+    for(int i=0;i<numPartitions;i++){
+        pi[i] = weights[i] / totalWeight;
+    }
+    
+    double doubleSum = 0.0000;
+    vector<double> logStore(numPartitions, 0.0000);
+    
+    source->rewind();
+    while(const countBlock* block = source->nextBlock()){
+        for(int row=0;row<block->numSamples;row++){
+            
+            double factor = 0.0000;
+            for(int k=block->rowStart[row];k<block->rowStart[row+1];k++){
+                factor += lgamma(block->counts[k] + 1.0000);
+            }
+            factor -= lgamma(block->totals[row] + 1.0);
+            
+            getBlockNegativeLogEvidence(*block, row, logStore);
+            
+            double offset = -numeric_limits<double>::max();
+            for(int k=0;k<numPartitions;k++){
+                logStore[k] = -logStore[k] - factor;
+                if(logStore[k] > offset){   offset = logStore[k];   }
+            }
+            
+            double probability = 0.0000;
+            for(int k=0;k<numPartitions;k++){
+                probability += pi[k] * exp(-offset + logStore[k]);
+            }
+            doubleSum += sampleWeights[block->firstSample + row] * (log(probability) + offset);
+        }
+    }
+    
+    double L5 = - numOTUs * numPartitions * lgamma(eta);
+    double L6 = eta * numPartitions * numOTUs * log(nu);
+    
+    double alphaSum, lambdaSum;
+    alphaSum = lambdaSum = 0.0000;
+    
+    for(int i=0;i<numPartitions;i++){
+        for(int j=0;j<numOTUs;j++){
+            alphaSum += exp(lambdaMatrix[i][j]);
+            lambdaSum += lambdaMatrix[i][j];
+        }
+    }
+    alphaSum *= -nu;
+    lambdaSum *= eta;
+    
+    return (-doubleSum - L5 - L6 - alphaSum - lambdaSum);
+}
+
+/**************************************************************************************************/
+
+//negativeLogEvidenceLambdaPi from the statistics of currentPartition; the samples with a zero count for
+//an otu contribute (weight - otuWeight) * lgamma(alpha), which cancels against the weight * lgamma(alpha) term
+
+double qFinderDMM::statsNegativeLogEvidence(vector<double>& x){
+    
+    double nu = 0.10000;
+    double eta = 0.10000;
+    
+    double sumLambda = 0.0000;
+    double alphaTotal = 0.0000;
+    double logE = 0.0000;
+    
+    for(int i=0;i<numOTUs;i++){
+        double alpha = exp(x[i]);
+        double lnGamma = lgamma(alpha);
+        sumLambda += x[i];
+        alphaTotal += alpha;
+        
+        for(int s=0;s<countValues[i].size();s++){
+            double weight = countWeights[i][s * numPartitions + currentPartition];
+            logE -= weight * (lgamma(alpha + countValues[i][s]) - lnGamma);
+        }
+    }
+    
+    double weight = 0.0000;
+    for(int t=0;t<totalValues.size();t++){
+        double totalWeight = totalWeights[t * numPartitions + currentPartition];
+        logE += totalWeight * lgamma(alphaTotal + totalValues[t]);
+        weight += totalWeight;
+    }
+    
+    return logE - weight * lgamma(alphaTotal) + nu * alphaTotal - eta * sumLambda;
+}
+
+/**************************************************************************************************/
+
+void qFinderDMM::statsNegativeLogDerivEvidence(vector<double>& x, vector<double>& df){
+    
+    double nu = 0.1000;
+    double eta = 0.1000;
+    
+    vector<double> alpha(numOTUs, 0.0000);
+    vector<double> derivative(numOTUs, 0.0000);
+    double store = 0.0000;
+    
+    for(int i=0;i<numOTUs;i++){
+        alpha[i] = exp(x[i]);
+        store += alpha[i];
+        
+        double psiAlpha = psi(alpha[i]);
+        for(int s=0;s<countValues[i].size();s++){
+            double weight = countWeights[i][s * numPartitions + currentPartition];
+            derivative[i] -= weight * (psi(alpha[i] + countValues[i][s]) - psiAlpha);
+        }
+    }
+    
+    double weight = 0.0000;
+    double sumStore = 0.0000;
+    for(int t=0;t<totalValues.size();t++){
+        double totalWeight = totalWeights[t * numPartitions + currentPartition];
+        sumStore += totalWeight * psi(store + totalValues[t]);
+        weight += totalWeight;
+    }
+    
+    store = weight * psi(store);
+    
+    df.resize(numOTUs, 0.0000);
+    
+    for(int i=0;i<numOTUs;i++){
+        df[i] = alpha[i] * (nu + derivative[i] - store + sumStore) - eta;
+    }
+}
+
+/**************************************************************************************************/
+
+vector<vector<double> > qFinderDMM::getStatsHessian(){
+    
+    vector<double> alpha(numOTUs, 0.0000);
+    double alphaSum = 0.0000;
+    
+    double weight = 0.0000;
+    double psi_Ck = 0.0000;
+    double psi1_Ck = 0.0000;
+    
+    for(int j=0;j<numOTUs;j++){
+        alpha[j] = exp(lambdaMatrix[currentPartition][j]);
+        alphaSum += alpha[j];
+    }
+    
+    for(int t=0;t<totalValues.size();t++){
+        double totalWeight = totalWeights[t * numPartitions + currentPartition];
+        weight += totalWeight;
+        psi_Ck += totalWeight * psi(alphaSum + totalValues[t]);
+        psi1_Ck += totalWeight * psi1(alphaSum + totalValues[t]);
+    }
+    
+    vector<double> psi_ajk(numOTUs, 0.0000);
+    vector<double> psi_cjk(numOTUs, 0.0000);
+    vector<double> psi1_ajk(numOTUs, 0.0000);
+    vector<double> psi1_cjk(numOTUs, 0.0000);
+    
+    for(int j=0;j<numOTUs;j++){
+        double psiAlpha = psi(alpha[j]);
+        double psi1Alpha = psi1(alpha[j]);
+        
+        psi_ajk[j] = weight * psiAlpha;
+        psi1_ajk[j] = weight * psi1Alpha;
+        
+        double zeroWeight = weight;
+        for(int s=0;s<countValues[j].size();s++){
+            double countWeight = countWeights[j][s * numPartitions + currentPartition];
+            psi_cjk[j] += countWeight * psi(alpha[j] + countValues[j][s]);
+            psi1_cjk[j] += countWeight * psi1(alpha[j] + countValues[j][s]);
+            zeroWeight -= countWeight;
+        }
+        psi_cjk[j] += zeroWeight * psiAlpha;
+        psi1_cjk[j] += zeroWeight * psi1Alpha;
+    }
+    
+    double psi_Ak = weight * psi(alphaSum);
+    double psi1_Ak = weight * psi1(alphaSum);
+    
+    vector<vector<double> > hessian(numOTUs);
+    for(int i=0;i<numOTUs;i++){ hessian[i].assign(numOTUs, 0.0000); }
+    
+    for(int i=0;i<numOTUs;i++){
+        double term1 = -alpha[i] * (- psi_ajk[i] + psi_Ak + psi_cjk[i] - psi_Ck);
+        double term2 = -alpha[i] * alpha[i] * (-psi1_ajk[i] + psi1_Ak + psi1_cjk[i] - psi1_Ck);
+        double term3 = 0.1 * alpha[i];
+        
+        hessian[i][i] = term1 + term2 + term3;
+        
+        for(int j=0;j<i;j++){
+            hessian[i][j] = - alpha[i] * alpha[j] * (psi1_Ak - psi1_Ck);
+            hessian[j][i] = hessian[i][j];
+        }
+    }
+    
+    return hessian;
+}
+
+/**************************************************************************************************/
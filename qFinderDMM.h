@@ -12,26 +12,85 @@
 /**************************************************************************************************/
 
 #include "pds_dmm.h"
+#include "dmmResults.h"
+#include "countSource.h"
+
+#include <random>
+#include <unordered_map>
+#include <functional>
 
 /**************************************************************************************************/
 
+//settings that change the outcome of a fit; everything here except the progress callback is part of
+//the fit cache key. progress, when set, is called with K, the EM iteration and the current NLL (or
+//with minus the pass number and 0 after each stochastic pass).
+//
+//a batchSize above 0 replaces the full EM iterations with stochasticPasses passes of mini-batch EM
+//followed by at most finalPasses full iterations for the final NLL and Laplace. a coresetSize above 0
+//(used by the library fit and sweep) fits a weighted sample of that many rows and then runs at most
+//refineIterations iterations on all of the data. coarseOTUs above 0 fits first on a table of that many
+//bins (the most abundant otus plus one pooled bin) and starts the full-resolution EM from that fit.
+//posteriors at or below activeThreshold are left out of the M-step. classificationEM assigns every sample
+//wholly to its most probable partition at each E-step, so each M-step only visits partition members; a
+//partition left without members is reseeded with the sample its own partition fits worst
+
+struct dmmOptions {
+
+    unsigned int seed;
+    double tolerance;
+    int maxIterations;
+
+    int batchSize;
+    int stochasticPasses;
+    int finalPasses;
+
+    int coresetSize;
+    int refineIterations;
+    int coarseOTUs;
+    double activeThreshold;
+    bool classificationEM;
+
+    function<void(int, int, double)> progress;
+
+    dmmOptions() : seed(0), tolerance(1.0e-6), maxIterations(100), batchSize(0), stochasticPasses(1), finalPasses(2), coresetSize(0), refineIterations(5), coarseOTUs(0), activeThreshold(0), classificationEM(false) {}
+
+};
+
+/**************************************************************************************************/
+
+//only the CountSource path is weighted. sample weights (coresets, -collapse, bootstrap and cross-validation
+//reweighting) reach a fit only through a source, and the stream kernels read them from sampleWeights. the
+//dense constructors take no weights and every row of a dense matrix counts once, so calculatePiK,
+//negativeLogEvidenceLambdaPi, getNegativeLogLikelihood and getHessian leave them out; weighted rows have
+//to be fitted as a source (e.g. a SparseCountMatrix with setSampleWeights)
+
 class qFinderDMM {
   
 public:
-    qFinderDMM(vector<vector<int> >, int);
-    qFinderDMM(vector<vector<int> >, vector<vector<double> >);
+    qFinderDMM(const vector<vector<int> >&, int, dmmOptions);
+    qFinderDMM(const vector<vector<int> >&, const vector<vector<double> >&);
+    qFinderDMM(const vector<vector<int> >&, const vector<vector<double> >&, const vector<vector<double> >&);
+    qFinderDMM(CountSource&, int, dmmOptions);
+    qFinderDMM(CountSource&, const vector<vector<double> >&, dmmOptions);
+    qFinderDMM(const vector<vector<int> >&, const dmmResults&, dmmOptions);
+    qFinderDMM(CountSource&, const dmmResults&, dmmOptions);
     double getNLL()     {    return currNLL;        }
     double getAIC()     {    return aic;            }
     double getBIC()     {    return bic;            }
     double getLogDet()  {    return logDeterminant; }
     double getLaplace() {    return laplace;        }
-    void printZMatrix(string, vector<string>);
-    void printRelAbund(string, vector<string>);
+    dmmResults getResults();
 
 private:
     
     void kMeans();
+    void fitPartitions(const vector<vector<double> >&, const vector<vector<double> >&);
+    void warmStart(const dmmResults&);
+    void runEM(int);
+    void stochasticEM();
+    void scaleStatistics(double);
     void optimizeLambda();
+    void refreshActiveSamples();
     void calculatePiK();
 
     double negativeLogEvidenceLambdaPi(vector<double>&);
@@ -39,6 +98,25 @@ private:
     double getNegativeLogEvidence(vector<double>&, int);
     double getNegativeLogLikelihood();
     vector<vector<double> > getHessian();
+    void calculateLaplace();
+    
+    void streamKMeans();
+    void streamKMeansPass(vector<vector<double> >&, vector<vector<double> >&, bool);
+    void streamPosteriors();
+    void streamStatistics();
+    void readSampleWeights();
+    void sumPartitionWeights();
+    double streamNegativeLogLikelihood();
+    void prepareEvidence();
+    void getBlockNegativeLogEvidence(const countBlock&, int, vector<double>&);
+    void addToStatistics(const countBlock&, int, double);
+    void updatePosterior(const countBlock&, int, vector<double>&);
+    void hardenPosterior(int, const vector<double>&);
+    bool reseedEmptyPartitions();
+    void clearStatistics();
+    double statsNegativeLogEvidence(vector<double>&);
+    void statsNegativeLogDerivEvidence(vector<double>&, vector<double>&);
+    vector<vector<double> > getStatsHessian();
     
     int lineMinimizeFletcher(vector<double>&, vector<double>&, double, double, double, double&, double&, vector<double>&, vector<double>&);
     int bfgs2_Solver(vector<double>&);//, double, double);
@@ -46,11 +124,36 @@ private:
     double psi(double);
     double psi1(double);
 
-    vector<vector<int> > countMatrix;
+    dmmOptions options;
+    mt19937 randomGenerator;
+
+    CountSource* source;
+    const vector<vector<int> >& countMatrix;
     vector<vector<double> > zMatrix;
     vector<vector<double> > lambdaMatrix;
     vector<double> weights;
     vector<vector<double> > error;
+    vector<vector<int> > activeSamples;
+    vector<double> assignedEvidence;
+    
+    //how many samples each row stands for (all 1 for dense counts or a source without weights) and their total,
+    //which takes the place of the number of samples in pi, the Laplace approximation and the BIC
+    vector<double> sampleWeights;
+    double totalWeight;
+    
+    //sufficient statistics for the out-of-core M-step: for every otu the distinct nonzero counts and,
+    //per partition, the summed posterior of the samples holding them (countWeights[otu][slot * numPartitions + k]);
+    //the sample totals are kept the same way
+    vector<vector<int> > countValues;
+    vector<vector<double> > countWeights;
+    vector<unordered_map<int, int> > countSlots;
+    vector<int> totalValues;
+    vector<double> totalWeights;
+    unordered_map<int, int> totalSlots;
+    
+    vector<vector<double> > alphaValues;
+    vector<vector<double> > lnGammaAlpha;
+    vector<double> sumAlpha;
     
     int numPartitions;
     int numSamples;
@@ -67,4 +170,10 @@ private:
 
 /**************************************************************************************************/
 
+//the relative abundance of every otu in every sample of a dense table, as the design fits start from
+
+vector<vector<double> > getRelativeAbundance(const vector<vector<int> >&);
+
+/**************************************************************************************************/
+
 #endif
@@ -0,0 +1,76 @@
+//
+//  resultWriter.cpp
+//  pds_dmm
+//
+//  Copyright (c) 2012 University of Michigan. All rights reserved.
+//
+
+#include "resultWriter.h"
+
+/**************************************************************************************************/
+
+resultWriter::resultWriter(vector<string>& s, vector<string>& o, outputSettings os, int q) : sampleNames(s), otuNames(o), settings(os), queueSize(q), finished(false) {
+
+    worker = thread(&resultWriter::run, this);
+}
+
+/**************************************************************************************************/
+
+resultWriter::~resultWriter(){
+    finish();
+}
+
+/**************************************************************************************************/
+
+//queues a fit for writing; the results are swapped into the queue, leaving the argument empty
+
+void resultWriter::write(string fileRoot, dmmResults& results){
+
+    unique_lock<mutex> lock(queueLock);
+    while((int)queue.size() >= queueSize){  notFull.wait(lock); }
+
+    queue.push_back(writeJob());
+    queue.back().fileRoot = fileRoot;
+    swap(queue.back().results, results);
+
+    notEmpty.notify_one();
+}
+
+/**************************************************************************************************/
+
+//waits for everything queued so far to reach the disk
+
+void resultWriter::finish(){
+
+    {
+        lock_guard<mutex> lock(queueLock);
+        finished = true;
+    }
+    notEmpty.notify_one();
+
+    if(worker.joinable()){  worker.join();  }
+}
+
+/**************************************************************************************************/
+
+void resultWriter::run(){
+
+    while(true){
+        writeJob job;
+
+        {
+            unique_lock<mutex> lock(queueLock);
+            while(queue.empty() && !finished){  notEmpty.wait(lock);    }
+
+            if(queue.empty()){  return; }
+
+            swap(job, queue.front());
+            queue.pop_front();
+        }
+        notFull.notify_one();
+
+        writeResults(job.fileRoot, job.results, sampleNames, otuNames, settings);
+    }
+}
+
+/**************************************************************************************************/
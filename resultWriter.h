@@ -0,0 +1,59 @@
+//
+//  resultWriter.h
+//  pds_dmm
+//
+//  Copyright (c) 2012 University of Michigan. All rights reserved.
+//
+
+#ifndef pds_dmm_resultWriter_h
+#define pds_dmm_resultWriter_h
+
+/**************************************************************************************************/
+
+#include "dmmResults.h"
+
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/**************************************************************************************************/
+
+//writes the per-K output files on a background thread so the next fit can start right away; at
+//most queueSize snapshots wait to be written before write() blocks
+
+class resultWriter {
+
+public:
+    resultWriter(vector<string>&, vector<string>&, outputSettings, int);
+    ~resultWriter();
+
+    void write(string, dmmResults&);
+    void finish();
+
+private:
+    struct writeJob {
+        string fileRoot;
+        dmmResults results;
+    };
+
+    void run();
+
+    vector<string>& sampleNames;
+    vector<string>& otuNames;
+    outputSettings settings;
+    int queueSize;
+
+    deque<writeJob> queue;
+    bool finished;
+
+    mutex queueLock;
+    condition_variable notEmpty;
+    condition_variable notFull;
+    thread worker;
+
+};
+
+/**************************************************************************************************/
+
+#endif
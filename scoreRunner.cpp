@@ -0,0 +1,156 @@
+//
+//  scoreRunner.cpp
+//  pds_dmm
+//
+//  Copyright (c) 2012 University of Michigan. All rights reserved.
+//
+
+#include "scoreRunner.h"
+
+/**************************************************************************************************/
+
+//rows are handed out in pieces of this many samples so the threads stay evenly loaded
+static const int rowsPerTask = 256;
+
+/**************************************************************************************************/
+
+//scores numRows rows of block starting at firstRow; column i of zMatrix receives row firstRow + i
+
+static void scoreRows(threadPool& pool, const dmmScorer& scorer, const countBlock& block, int firstRow, int numRows, vector<vector<double> >& zMatrix){
+
+    int numPartitions = scorer.getNumPartitions();
+    zMatrix.assign(numPartitions, vector<double>(numRows, 0.0000));
+
+    for(int start=0;start<numRows;start+=rowsPerTask){
+        int end = min(start + rowsPerTask, numRows);
+
+        pool.submit([&scorer, &block, &zMatrix, firstRow, start, end, numPartitions](){
+            vector<double> posteriors;
+            for(int i=start;i<end;i++){
+                int rowBegin = block.rowStart[firstRow + i];
+                int numNonZero = block.rowStart[firstRow + i + 1] - rowBegin;
+
+                scorer.scoreSample(numNonZero ? &block.otus[rowBegin] : NULL, numNonZero ? &block.counts[rowBegin] : NULL, numNonZero, posteriors);
+                for(int k=0;k<numPartitions;k++){   zMatrix[k][i] = posteriors[k];  }
+            }
+        }, 0);
+    }
+    pool.wait();
+}
+
+/**************************************************************************************************/
+
+//same layout as the posterior files of a fit: a dense table, or with topK the (sample, partition, posterior)
+//lines of the sparse form
+
+static void writeRows(ostream& outFile, vector<vector<double> >& zMatrix, vector<string>& sampleNames, int nameOffset, outputSettings& settings, vector<int>& partitionSizes){
+
+    int numPartitions = (int)zMatrix.size();
+    int numRows = numPartitions ? (int)zMatrix[0].size() : 0;
+
+    for(int i=0;i<numRows;i++){
+        string& sampleName = sampleNames[nameOffset + i];
+
+        vector<pair<int, double> > posteriors = getTopPosteriors(zMatrix, i, max(settings.topK, 1), settings.minPosterior);
+        partitionSizes[posteriors[0].first]++;
+
+        if(settings.topK == 0){
+            outFile << sampleName;
+            for(int k=0;k<numPartitions;k++){   outFile << setprecision(4) << '\t' << zMatrix[k][i]; }
+            outFile << endl;
+        }
+        else{
+            for(int j=0;j<posteriors.size();j++){
+                outFile << sampleName << "\tPartition_" << posteriors[j].first+1 << '\t' << setprecision(4) << posteriors[j].second << endl;
+            }
+        }
+    }
+}
+
+/**************************************************************************************************/
+
+//writes <outputRoot>score.posterior, or a "score.posterior" section to stdout with -output stream
+
+void runScoring(string modelFileName, string sharedFileName, string outputRoot, scoreSettings& settings){
+
+    dmmResults model;
+    vector<string> modelSamples, modelOTUs;
+    if(!readBinaryResults(modelFileName, model, modelSamples, modelOTUs)){
+        cerr << "Error: could not read the model in " << modelFileName << endl;
+        exit(1);
+    }
+
+    //shared files are streamed; BIOM and MatrixMarket tables are read whole and scored in pieces
+    string extension = (sharedFileName == "-") ? "" : sharedFileName.substr(sharedFileName.find_last_of(".")+1);
+
+    SharedFileReader* reader = NULL;
+    SparseCountMatrix* sparseMatrix = NULL;
+    vector<string> otuNames, sampleNames;
+
+    if(extension == "biom" || extension == "mtx"){
+        vector<vector<int> > unused;
+        sparseMatrix = (SparseCountMatrix*)readCountFile(sharedFileName, "", 0, unused, otuNames, sampleNames);
+    }
+    else{
+        reader = new SharedFileReader(sharedFileName, settings.blockSize);
+        otuNames = reader->getOTUNames();
+    }
+
+    dmmScorer scorer(model, modelOTUs, otuNames);
+    if(scorer.getNumMatched() == 0){
+        cerr << "Error: none of the OTUs in " << sharedFileName << " are in the model." << endl;
+        exit(1);
+    }
+
+    ostream& console = settings.output.writeStream ? cerr : cout;
+    console << "matched " << scorer.getNumMatched() << " of " << modelOTUs.size() << " model OTUs" << endl;
+
+    ofstream outFile;
+    if(!settings.output.writeStream){   outFile.open((outputRoot + "score.posterior").c_str());    }
+    ostream& scoreFile = settings.output.writeStream ? cout : outFile;
+
+    scoreFile.setf(ios::fixed, ios::floatfield);
+    scoreFile.setf(ios::showpoint);
+
+    if(settings.output.writeStream){    scoreFile << streamSectionMarker << outputRoot << "score.posterior" << endl;   }
+    if(settings.output.topK == 0){
+        for(int k=0;k<model.numPartitions;k++){ scoreFile << "\tPartition_" << k+1; }
+        scoreFile << endl;
+    }
+    else{
+        scoreFile << "Group\tPartition\tPosterior" << endl;
+    }
+
+    threadPool pool(settings.processors);
+    vector<vector<double> > zMatrix;
+    vector<int> partitionSizes(model.numPartitions, 0);
+    int numScored = 0;
+
+    if(reader != NULL){
+        while(const countBlock* block = reader->nextBlock(sampleNames)){
+            scoreRows(pool, scorer, *block, 0, block->numSamples, zMatrix);
+            writeRows(scoreFile, zMatrix, sampleNames, 0, settings.output, partitionSizes);
+            numScored += block->numSamples;
+        }
+    }
+    else{
+        const countBlock& block = sparseMatrix->getBlock();
+        for(int start=0;start<block.numSamples;start+=settings.blockSize){
+            int numRows = min(settings.blockSize, block.numSamples - start);
+            scoreRows(pool, scorer, block, start, numRows, zMatrix);
+            writeRows(scoreFile, zMatrix, sampleNames, start, settings.output, partitionSizes);
+            numScored += numRows;
+        }
+    }
+    scoreFile.flush();
+
+    console << "scored " << numScored << " samples" << endl;
+    for(int k=0;k<model.numPartitions;k++){
+        console << "Partition_" << k+1 << '\t' << partitionSizes[k] << endl;
+    }
+
+    delete reader;
+    delete sparseMatrix;
+}
+
+/**************************************************************************************************/
@@ -0,0 +1,36 @@
+//
+//  scoreRunner.h
+//  pds_dmm
+//
+//  Copyright (c) 2012 University of Michigan. All rights reserved.
+//
+
+#ifndef pds_dmm_scoreRunner_h
+#define pds_dmm_scoreRunner_h
+
+/**************************************************************************************************/
+
+#include "dmmScorer.h"
+#include "threadPool.h"
+
+/**************************************************************************************************/
+
+//assigns the samples of a count file to the partitions of a saved model without refitting. shared
+//files are read a block of samples at a time, each block is scored on all processors and its rows are
+//written before the next block is read, so memory does not grow with the number of samples
+
+struct scoreSettings {
+
+    outputSettings output;
+    int processors;
+    int blockSize;
+
+};
+
+/**************************************************************************************************/
+
+void runScoring(string, string, string, scoreSettings&);
+
+/**************************************************************************************************/
+
+#endif
@@ -0,0 +1,84 @@
+//
+//  threadPool.cpp
+//  pds_dmm
+//
+//  Copyright (c) 2012 University of Michigan. All rights reserved.
+//
+
+#include "threadPool.h"
+
+/**************************************************************************************************/
+
+threadPool::threadPool(int numThreads) : numSubmitted(0), numRunning(0), finished(false) {
+
+    if(numThreads < 1){ numThreads = 1; }
+    for(int i=0;i<numThreads;i++){
+        workers.push_back(thread(&threadPool::run, this));
+    }
+}
+
+/**************************************************************************************************/
+
+threadPool::~threadPool(){
+
+    {
+        lock_guard<mutex> lock(poolLock);
+        finished = true;
+    }
+    taskReady.notify_all();
+
+    for(int i=0;i<workers.size();i++){  workers[i].join();  }
+}
+
+/**************************************************************************************************/
+
+//tasks with equal cost run in the order they were submitted
+
+void threadPool::submit(function<void()> work, double cost){
+
+    lock_guard<mutex> lock(poolLock);
+
+    poolTask task;
+    task.cost = cost;
+    task.order = numSubmitted++;
+    task.work = work;
+    tasks.push(task);
+
+    taskReady.notify_one();
+}
+
+/**************************************************************************************************/
+
+void threadPool::wait(){
+
+    unique_lock<mutex> lock(poolLock);
+    while(!tasks.empty() || numRunning > 0){    allDone.wait(lock); }
+}
+
+/**************************************************************************************************/
+
+void threadPool::run(){
+
+    while(true){
+        function<void()> work;
+        {
+            unique_lock<mutex> lock(poolLock);
+            while(tasks.empty() && !finished){  taskReady.wait(lock);   }
+            if(tasks.empty()){  return; }
+
+            work = tasks.top().work;
+            tasks.pop();
+            numRunning++;
+        }
+
+        work();
+
+        {
+            lock_guard<mutex> lock(poolLock);
+            numRunning--;
+            if(tasks.empty() && numRunning == 0){   allDone.notify_all();   }
+        }
+    }
+}
+
+/**************************************************************************************************/
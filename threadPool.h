@@ -0,0 +1,65 @@
+//
+//  threadPool.h
+//  pds_dmm
+//
+//  Copyright (c) 2012 University of Michigan. All rights reserved.
+//
+
+#ifndef pds_dmm_threadPool_h
+#define pds_dmm_threadPool_h
+
+/**************************************************************************************************/
+
+#include "pds_dmm.h"
+
+#include <queue>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/**************************************************************************************************/
+
+//fixed set of worker threads that always run the most expensive waiting task next; tasks may submit
+//further tasks, and wait() returns once nothing is queued or running
+
+class threadPool {
+
+public:
+    threadPool(int);
+    ~threadPool();
+
+    void submit(function<void()>, double);
+    void wait();
+
+    int getNumThreads()     {   return (int)workers.size(); }
+
+private:
+    struct poolTask {
+        double cost;
+        long order;
+        function<void()> work;
+
+        bool operator<(const poolTask& other) const {
+            if(cost != other.cost)  {   return cost < other.cost;   }
+            return order > other.order;
+        }
+    };
+
+    void run();
+
+    vector<thread> workers;
+    priority_queue<poolTask> tasks;
+    long numSubmitted;
+    int numRunning;
+    bool finished;
+
+    mutex poolLock;
+    condition_variable taskReady;
+    condition_variable allDone;
+
+};
+
+/**************************************************************************************************/
+
+#endif